@@ -4,8 +4,16 @@
  */
 
 #include <stdlib.h>
+#include <string.h> // for memset()
+#include <stdint.h> // for SIZE_MAX
 #include <assert.h>
 #include <stdio.h> // for perror()
+#include <time.h> // for timespec_get()
+
+#ifdef MEM_POOL_THREAD_SAFE
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
 
 #include "mem_pool.h"
 
@@ -20,14 +28,55 @@
 static const unsigned   MEM_POOL_STORE_INIT_CAPACITY    = 20;
 static const float      MEM_POOL_STORE_FILL_FACTOR      = 0.75;
 static const unsigned   MEM_POOL_STORE_EXPAND_FACTOR    = 2;
+static const float      MEM_POOL_STORE_SHRINK_FACTOR    = 0.25;
 
-static const unsigned   MEM_NODE_HEAP_INIT_CAPACITY     = 40;
-static const float      MEM_NODE_HEAP_FILL_FACTOR       = 0.75;
+static const unsigned   MEM_NODE_HEAP_CHUNK_NODES       = 64; // nodes per chunk
+static const unsigned   MEM_NODE_HEAP_INIT_CHUNKS       = 4;  // chunk slots
 static const unsigned   MEM_NODE_HEAP_EXPAND_FACTOR     = 2;
 
 static const unsigned   MEM_GAP_IX_INIT_CAPACITY        = 40;
 static const float      MEM_GAP_IX_FILL_FACTOR          = 0.75;
 static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
+static const unsigned   MEM_GAP_IX_NIL                  = (unsigned) -1;
+
+static const size_t     MEM_QUICK_MAX_SIZE              = 1024;
+
+static const size_t     MEM_SHARD_ALIGN                 = 16;
+
+static const unsigned   MEM_ARENA_CHUNK_RECORDS         = 256; // per chunk
+static const unsigned   MEM_ARENA_INIT_CHUNKS           = 4;   // chunk slots
+static const unsigned   MEM_ARENA_EXPAND_FACTOR         = 2;
+
+// batch frees: radix sort by address from this many allocations up
+static const unsigned   MEM_BATCH_RADIX_MIN             = 64;
+#define MEM_RADIX_BUCKETS   256 // one 8-bit digit per pass
+
+// gap index sizes and addresses are offsets from pool.mem, 32 bits wide
+// when MEM_POOL_SMALL builds keep every pool under 4 GiB
+#ifdef MEM_POOL_SMALL
+typedef uint32_t gap_off_t;
+#else
+typedef size_t gap_off_t;
+#endif
+static const size_t     MEM_GAP_OFF_MAX                 = (gap_off_t) -1;
+
+// handles: low bits are the node index + 1, high bits the generation
+static const unsigned   MEM_HANDLE_INDEX_BITS           = 24;
+static const uint32_t   MEM_HANDLE_INDEX_MASK           = (1u << 24) - 1;
+
+// TLSF: 2^MEM_TLSF_SL_LOG2 second-level lists per power of two
+#define MEM_TLSF_SL_LOG2    4
+#define MEM_TLSF_SL_COUNT   (1 << MEM_TLSF_SL_LOG2)
+#define MEM_TLSF_FL_COUNT   64
+
+// thread caches: each thread caches blocks for up to MEM_TCACHE_POOLS
+// pools, in bins MEM_TCACHE_BIN_STEP bytes wide, MEM_TCACHE_BIN_BLOCKS deep
+#ifdef MEM_POOL_THREAD_SAFE
+#define MEM_TCACHE_POOLS        4
+#define MEM_TCACHE_BINS         16
+#define MEM_TCACHE_BIN_BLOCKS   16 // high-water mark, half go back when hit
+static const size_t     MEM_TCACHE_BIN_STEP             = 16;
+#endif
 
 
 
@@ -38,25 +87,110 @@ static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
 /*********************/
 typedef struct _node {
     alloc_t alloc_record;
-    unsigned used;
-    unsigned allocated;
     struct _node *next, *prev; // doubly-linked list for gap deletion
+    unsigned gap_slot; // gap_ix slot while a gap, next quick node if cached
+    unsigned index;    // position in the node heap, fixed for life
+    unsigned allocated : 1;  // 0 for gaps and for unused nodes
+    unsigned cached    : 1;  // freed, waiting on a quick list (allocated)
+    unsigned generation;     // bumped each time the allocation is deleted
 } node_t, *node_pt;
 
 typedef struct _gap {
-    size_t size;
-    node_pt node;
+    gap_off_t size;
+    gap_off_t max_size;   // largest gap in the subtree rooted here
+    gap_off_t offset;     // the gap's place in pool.mem, so the tree never
+                          // reads nodes
+    unsigned node;        // node heap index of the gap's node
+    unsigned left, right; // AVL subtrees (gap_ix slots), left is the free list
+    unsigned height;      // AVL height of the subtree rooted here
 } gap_t, *gap_pt;
 
+typedef struct _tlsf {
+    unsigned long long fl_bitmap; // bit fl set if any sl_bitmap[fl] bit is
+    unsigned sl_bitmap[MEM_TLSF_FL_COUNT]; // bit sl set if list is non-empty
+    unsigned heads[MEM_TLSF_FL_COUNT][MEM_TLSF_SL_COUNT]; // gap_ix slots
+} tlsf_t, *tlsf_pt;
+
+typedef struct _slab {
+    size_t obj_size;    // object stride, a multiple of sizeof(char *)
+    unsigned num_objs;
+    unsigned num_carved; // objects below this index have been handed out
+    char *free_list;     // freed objects, linked through their first bytes
+    alloc_pt records;    // one record per object, mem == NULL when free
+} slab_t, *slab_pt;
+
+typedef struct _arena {
+    size_t offset;        // first byte of pool.mem not handed out
+    alloc_pt *chunks;     // fixed-size chunks of records, never moved
+    unsigned chunk_capacity; // slots in chunks for chunk pointers
+    unsigned num_chunks;  // chunks allocated, kept across resets
+    unsigned num_records; // records handed out, in address order
+} arena_t, *arena_pt;
+
+struct _mem_ctx {
+    struct _pool_mgr **pool_store; // an array of pointers, kept dense
+    unsigned pool_store_size;
+    unsigned pool_store_capacity;
+#ifdef MEM_POOL_THREAD_SAFE
+    pthread_mutex_t store_lock; // guards the three above
+#endif
+};
+
 typedef struct _pool_mgr {
     pool_t pool;
-    node_pt node_heap;
-    unsigned total_nodes;
+    mem_ctx_pt ctx;       // whose store holds the pool, NULL for shards
+    unsigned store_slot;  // index in the store, so close needs no search
+    node_pt *node_heap;    // fixed-size chunks of nodes, never moved
+    unsigned node_heap_capacity; // slots in node_heap for chunk pointers
+    unsigned total_nodes;  // chunks allocated * MEM_NODE_HEAP_CHUNK_NODES
     unsigned used_nodes;
+    unsigned top_node;     // node indices at and above this never used
+    node_pt unused_nodes;  // released nodes, linked through next
+    node_pt head_node;     // first node in the list, moved only by compaction
+    node_pt tail_node;     // last node in the list, where rewinds cut
+    unsigned long node_reuses;   // nodes taken off unused_nodes
+    unsigned long node_releases; // nodes put on unused_nodes
     gap_pt gap_ix;
     unsigned gap_ix_capacity;
+    unsigned gap_ix_root; // root slot of the gap tree
+    unsigned gap_ix_free; // first unused slot in gap_ix
+    char *rover;          // NEXT_FIT: end of the last allocation
+    unsigned *quick_heads; // first cached node per exact size, NULL if off
+    size_t quick_max;      // largest size the quick lists cache
+    unsigned quick_blocks; // nodes cached on the quick lists
+    unsigned long remote_frees; // blocks freed through the remote queue
+    node_pt compact_gap;  // gap compaction steps slide up, NULL to pick
+    tlsf_pt tlsf;         // segregated free lists, TLSF and BUDDY pools
+    slab_pt slab;         // object free list, FIXED pools only
+    arena_pt arena;       // bump offset and records, ARENA pools only
+    struct _pool_mgr **shards; // pools over slices of mem, NULL if unsharded
+    unsigned num_shards;
+    size_t shard_size;    // bytes per shard, the last one takes the rest
+#ifdef MEM_POOL_THREAD_SAFE
+    pthread_mutex_t lock; // held by every call on the pool but snapshot
+    atomic_uint seq;      // odd while a writer is changing the pool
+    atomic_size_t snap_alloc_size; // pool_t counters as of the last
+    atomic_uint snap_num_allocs;   // write, published under seq for
+    atomic_uint snap_num_gaps;     // mem_pool_snapshot to load
+    atomic_uint tcache_on; // threads may cache freed blocks lock-free
+    atomic_uint remote_on; // frees off the owner thread are queued
+    pthread_t owner;       // the thread that drains the remote queue
+    atomic_uint remote_head; // remote-freed nodes, linked through gap_slot
+#endif
 } pool_mgr_t, *pool_mgr_pt;
 
+#ifdef MEM_POOL_THREAD_SAFE
+typedef struct _tcache_bin {
+    unsigned count;
+    alloc_pt blocks[MEM_TCACHE_BIN_BLOCKS]; // oldest first
+} tcache_bin_t, *tcache_bin_pt;
+
+typedef struct _tcache {
+    pool_mgr_pt pool_mgr; // pool the bins belong to, NULL if slot unused
+    tcache_bin_t bins[MEM_TCACHE_BINS];
+} tcache_t, *tcache_pt;
+#endif
+
 
 
 /***************************/
@@ -64,9 +198,15 @@ typedef struct _pool_mgr {
 /* Static global variables */
 /*                         */
 /***************************/
-static pool_mgr_pt *pool_store = NULL; // an array of pointers, only expand
-static unsigned pool_store_size = 0;
-static unsigned pool_store_capacity = 0;
+static mem_ctx_t default_ctx = {0}; // for mem_init(), mem_pool_open()
+#ifdef MEM_POOL_THREAD_SAFE
+static pthread_once_t default_ctx_once = PTHREAD_ONCE_INIT; // store_lock
+static _Thread_local tcache_pt thread_caches = NULL; // MEM_TCACHE_POOLS
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key; // flushes thread_caches at thread exit
+static atomic_uint shard_threads = 0; // threads given a home shard so far
+static _Thread_local unsigned thread_shard = 0; // home shard + 1, 0 if none
+#endif
 
 
 
@@ -75,9 +215,141 @@ static unsigned pool_store_capacity = 0;
 /* Forward declarations of static functions */
 /*                                          */
 /********************************************/
-static alloc_status _mem_resize_pool_store();
+static alloc_status _mem_init(mem_ctx_pt ctx);
+static alloc_status _mem_free(mem_ctx_pt ctx);
+static pool_pt
+        _mem_pool_open(mem_ctx_pt ctx,
+                       size_t size,
+                       alloc_policy policy);
+static pool_pt
+        _mem_pool_open_fixed(mem_ctx_pt ctx,
+                             size_t obj_size,
+                             unsigned num_objs);
+static pool_pt
+        _mem_pool_open_sharded(mem_ctx_pt ctx,
+                               size_t size,
+                               alloc_policy policy,
+                               unsigned num_shards);
+static pool_mgr_pt
+        _mem_pool_create(char *mem,
+                         size_t size,
+                         alloc_policy policy);
+static alloc_status _mem_pool_close(pool_pt pool);
+static alloc_status _mem_pool_reset(pool_pt pool);
+static alloc_status _mem_pool_mark(pool_pt pool, mem_pool_mark_t *mark);
+static alloc_status _mem_pool_rewind(pool_pt pool, mem_pool_mark_t mark);
+static alloc_status _mem_pool_compact(pool_pt pool, pool_compact_pt report);
+static alloc_status
+        _mem_pool_compact_step(pool_pt pool,
+                               size_t max_bytes,
+                               unsigned long max_ns,
+                               const struct timespec *start,
+                               pool_compact_pt report);
+static int
+        _mem_compact_budget_left(size_t max_bytes,
+                                 unsigned long max_ns,
+                                 const struct timespec *start,
+                                 pool_compact_pt report);
+static alloc_status
+        _mem_compact_pick(pool_mgr_pt pool_mgr,
+                          node_pt *gap_node);
+static alloc_status
+        _mem_compact_fill(pool_mgr_pt pool_mgr,
+                          node_pt gap_node,
+                          node_pt alloc_node,
+                          pool_compact_pt report);
+static alloc_status
+        _mem_compact_slide(pool_mgr_pt pool_mgr,
+                           node_pt gap_node,
+                           pool_compact_pt report);
+static alloc_status
+        _mem_compact_merge_back(pool_mgr_pt pool_mgr,
+                                node_pt gap_node);
+static node_pt _mem_largest_gap(pool_mgr_pt pool_mgr);
+static unsigned long _mem_elapsed_ns(const struct timespec *start);
+static int _mem_pool_is_empty(pool_mgr_pt pool_mgr);
+static void _mem_pool_destroy(pool_mgr_pt pool_mgr);
+static alloc_pt _mem_new_alloc(pool_pt pool, size_t size);
+static alloc_pt _mem_new_alloc_shards(pool_mgr_pt pool_mgr, size_t size);
+static node_pt _mem_find_gap(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status
+        _mem_new_alloc_batch(pool_pt pool,
+                             const size_t *sizes,
+                             unsigned num_allocs,
+                             alloc_pt *allocs);
+static alloc_status _mem_del_alloc(pool_pt pool, alloc_pt alloc);
+static alloc_status
+        _mem_del_alloc_batch(pool_pt pool,
+                             alloc_pt *allocs,
+                             unsigned num_allocs);
+static void
+        _mem_sort_allocs(alloc_pt *allocs,
+                         unsigned num_allocs,
+                         char *base,
+                         size_t span);
+static mem_alloc_handle_t _mem_new_handle(pool_pt pool, size_t size);
+static alloc_status _mem_del_handle(pool_pt pool, mem_alloc_handle_t handle);
+static void
+        _mem_inspect_pool(pool_pt pool,
+                          pool_segment_pt *segments,
+                          unsigned *num_segments);
+static alloc_status _mem_pool_set_quick_lists(pool_pt pool, size_t max_size);
+static alloc_status _mem_pool_flush_quick_lists(pool_pt pool);
+static unsigned _mem_shard_count(pool_mgr_pt pool_mgr);
+static pool_mgr_pt _mem_shard_at(pool_mgr_pt pool_mgr, unsigned shard);
+static pool_mgr_pt _mem_shard_of(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static unsigned _mem_shard_home(unsigned num_shards);
+static void
+        _mem_shards_inspect(pool_mgr_pt pool_mgr,
+                            pool_segment_pt *segments,
+                            unsigned *num_segments);
+static void _mem_read_pool(pool_mgr_pt pool_mgr, pool_pt copy);
+static void _mem_store_lock(mem_ctx_pt ctx);
+static void _mem_store_unlock(mem_ctx_pt ctx);
+#ifdef MEM_POOL_THREAD_SAFE
+static void _mem_default_ctx_init(void);
+static tcache_pt _mem_tcache_get(pool_mgr_pt pool_mgr, int create);
+static alloc_pt _mem_tcache_pop(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_tcache_push(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static void
+        _mem_tcache_drain(pool_mgr_pt pool_mgr,
+                          tcache_bin_pt bin,
+                          unsigned keep);
+static void _mem_tcache_flush(tcache_pt tcache);
+static void _mem_tcache_key_init(void);
+static void _mem_tcache_exit(void *caches);
+static alloc_status _mem_remote_push(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static void _mem_remote_drain(pool_mgr_pt pool_mgr);
+#endif
+static void _mem_init_lock(pool_mgr_pt pool_mgr);
+static void _mem_destroy_lock(pool_mgr_pt pool_mgr);
+static void _mem_lock(pool_mgr_pt pool_mgr);
+static void _mem_unlock(pool_mgr_pt pool_mgr);
+static void _mem_write_begin(pool_mgr_pt pool_mgr);
+static void _mem_write_end(pool_mgr_pt pool_mgr);
+static int _mem_tcache_on(pool_mgr_pt pool_mgr);
+static alloc_status _mem_resize_pool_store(mem_ctx_pt ctx);
+static void _mem_store_add(mem_ctx_pt ctx, pool_mgr_pt pool_mgr);
+static void _mem_store_remove(pool_mgr_pt pool_mgr);
 static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr);
+static alloc_status
+        _mem_reserve_nodes(pool_mgr_pt pool_mgr,
+                           unsigned num_nodes);
+static alloc_status _mem_expand_node_heap(pool_mgr_pt pool_mgr);
+static void _mem_free_node_heap(pool_mgr_pt pool_mgr);
+static node_pt _mem_node_at(pool_mgr_pt pool_mgr, unsigned index);
+static node_pt _mem_get_unused_node(pool_mgr_pt pool_mgr);
+static node_pt
+        _mem_handle_node(pool_mgr_pt pool_mgr,
+                         mem_alloc_handle_t handle);
+static void _mem_put_unused_node(pool_mgr_pt pool_mgr, node_pt node);
+static alloc_status
+        _mem_merge_gap(pool_mgr_pt pool_mgr,
+                       node_pt node_to_delete);
+static void _mem_quick_push(pool_mgr_pt pool_mgr, node_pt node);
+static node_pt _mem_quick_pop(pool_mgr_pt pool_mgr, size_t size);
 static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr);
+static void _mem_clear_gap_ix(pool_mgr_pt pool_mgr);
 static alloc_status
         _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
                            size_t size,
@@ -86,7 +358,66 @@ static alloc_status
         _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
                                 size_t size,
                                 node_pt node);
-static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr);
+static int
+        _mem_cmp_gap_ix(pool_mgr_pt pool_mgr,
+                        size_t size_a, size_t offset_a, unsigned node_a,
+                        size_t size_b, size_t offset_b, unsigned node_b);
+static unsigned _mem_gap_ix_height(pool_mgr_pt pool_mgr, unsigned slot);
+static void _mem_gap_ix_update(pool_mgr_pt pool_mgr, unsigned slot);
+static unsigned _mem_gap_ix_rotate_left(pool_mgr_pt pool_mgr, unsigned slot);
+static unsigned _mem_gap_ix_rotate_right(pool_mgr_pt pool_mgr, unsigned slot);
+static unsigned _mem_gap_ix_rebalance(pool_mgr_pt pool_mgr, unsigned slot);
+static unsigned
+        _mem_gap_ix_insert(pool_mgr_pt pool_mgr,
+                           unsigned root,
+                           unsigned slot);
+static unsigned
+        _mem_gap_ix_delete(pool_mgr_pt pool_mgr,
+                           unsigned root,
+                           size_t size,
+                           size_t offset,
+                           unsigned node,
+                           unsigned *removed);
+static unsigned
+        _mem_gap_ix_delete_min(pool_mgr_pt pool_mgr,
+                               unsigned root,
+                               unsigned *removed);
+static node_pt _mem_gap_ix_best_fit(pool_mgr_pt pool_mgr, size_t size);
+static node_pt _mem_gap_ix_first_fit(pool_mgr_pt pool_mgr, size_t size);
+static node_pt _mem_gap_ix_next_fit(pool_mgr_pt pool_mgr, size_t size);
+static unsigned
+        _mem_gap_ix_fit_after(pool_mgr_pt pool_mgr,
+                              unsigned root,
+                              size_t size,
+                              char *from);
+static unsigned _mem_tlsf_ctz(unsigned long long bits);
+static unsigned _mem_tlsf_msb(size_t size);
+static void
+        _mem_tlsf_mapping(size_t size,
+                          unsigned *fl,
+                          unsigned *sl);
+static void _mem_tlsf_insert(pool_mgr_pt pool_mgr, unsigned slot);
+static void _mem_tlsf_remove(pool_mgr_pt pool_mgr, unsigned slot);
+static node_pt _mem_tlsf_find(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_buddy_init(pool_mgr_pt pool_mgr);
+static node_pt _mem_buddy_alloc(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_buddy_free(pool_mgr_pt pool_mgr, node_pt node);
+static alloc_pt _mem_slab_alloc(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_slab_free(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static int _mem_slab_is_free(pool_mgr_pt pool_mgr, long index);
+static void
+        _mem_slab_inspect(pool_mgr_pt pool_mgr,
+                          pool_segment_pt *segments,
+                          unsigned *num_segments);
+static alloc_status _mem_arena_init(pool_mgr_pt pool_mgr);
+static alloc_pt _mem_arena_alloc(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_arena_free(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static alloc_pt _mem_arena_record(pool_mgr_pt pool_mgr, unsigned index);
+static void _mem_arena_rewind(pool_mgr_pt pool_mgr, size_t offset);
+static void
+        _mem_arena_inspect(pool_mgr_pt pool_mgr,
+                           pool_segment_pt *segments,
+                           unsigned *num_segments);
 
 
 
@@ -97,559 +428,4226 @@ static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr);
 /****************************************/
 alloc_status mem_init()
 {
-    if(pool_store == NULL)
-    {// allocate the pool store with initial capacity
-        pool_store = (pool_mgr_pt*)
-                calloc(MEM_POOL_STORE_INIT_CAPACITY, sizeof(pool_mgr_pt));
-        pool_store_size = 0;
-        pool_store_capacity = MEM_POOL_STORE_INIT_CAPACITY;
-        return ALLOC_OK;
-    }
-    else
-    {// ensure that it's called only once until mem_free
-        return ALLOC_CALLED_AGAIN;
-    }
+    _mem_store_lock(&default_ctx);
+    alloc_status status = _mem_init(&default_ctx);
+    _mem_store_unlock(&default_ctx);
+
+    return status;
 }//End mem_init
 
 alloc_status mem_free()
 {
-    if(pool_store == NULL)
-    {// ensure that it's called only once for each mem_init
-        return ALLOC_CALLED_AGAIN;
-    }
+    _mem_store_lock(&default_ctx);
+    alloc_status status = _mem_free(&default_ctx);
+    _mem_store_unlock(&default_ctx);
 
-    for(int de_alloc = 0; de_alloc < pool_store_size; de_alloc++)
-    {// make sure all pool managers have been deallocated
-        if(pool_store[de_alloc] != NULL)
-        {
-            return ALLOC_FAIL;
-        }
-    }
+    return status;
+}//End mem_free
 
-    // can free the pool store array
-    free(pool_store);
+pool_pt mem_pool_open(size_t size, alloc_policy policy)
+{
+    return mem_ctx_pool_open(&default_ctx, size, policy);
+}//End mem_pool_open
 
-    // update static variables
-    pool_store = NULL;
-    pool_store_size = 0;
-    pool_store_capacity = 0;
-    return ALLOC_OK;
+pool_pt mem_pool_open_fixed(size_t obj_size, unsigned num_objs)
+{
+    return mem_ctx_pool_open_fixed(&default_ctx, obj_size, num_objs);
+}//End mem_pool_open_fixed
 
-}//End mem_free
+pool_pt mem_pool_open_sharded(size_t size,
+                              alloc_policy policy,
+                              unsigned num_shards)
+{
+    return mem_ctx_pool_open_sharded(&default_ctx, size, policy, num_shards);
+}//End mem_pool_open_sharded
 
-pool_pt mem_pool_open(size_t size, alloc_policy policy)
+mem_ctx_pt mem_ctx_create()
 {
-    if(pool_store == NULL)
-    {// make sure there the pool store is allocated
+    mem_ctx_pt ctx = (mem_ctx_pt) calloc(1, sizeof(mem_ctx_t));
+
+    if(ctx == NULL)
+    {// check success
         return NULL;
     }
 
-    // expand the pool store, if necessary
-    _mem_resize_pool_store();
-
-    // allocate a new mem pool mgr
-    pool_mgr_pt pool_manager = calloc(1, sizeof(pool_mgr_t));
+#ifdef MEM_POOL_THREAD_SAFE
+    pthread_mutex_init(&(*ctx).store_lock, NULL);
+#endif
 
-    if(pool_manager == NULL)
-    {// check success, on error return null
+    if(_mem_init(ctx) != ALLOC_OK || (*ctx).pool_store == NULL)
+    {// check the store got allocated
+        mem_ctx_destroy(ctx);
         return NULL;
     }
 
-    // allocate a new memory pool
-    (*pool_manager).pool.mem = (char*) calloc(size, sizeof(char));
+    return ctx;
+}//End mem_ctx_create
 
-    if((*pool_manager).pool.mem == NULL)
-    {// check success, on error deallocate mgr and return null
-        free(pool_manager);
-        return NULL;
+alloc_status mem_ctx_destroy(mem_ctx_pt ctx)
+{
+    if(ctx == NULL || ctx == &default_ctx)
+    {// the default context is mem_free()'s
+        return ALLOC_FAIL;
     }
 
-    // allocate a new node heap
-    (*pool_manager).node_heap = (node_pt)
-            calloc(MEM_NODE_HEAP_INIT_CAPACITY, sizeof(node_t));
+    _mem_store_lock(ctx);
+    alloc_status status = ((*ctx).pool_store == NULL) ?
+                          ALLOC_OK : _mem_free(ctx);
+    _mem_store_unlock(ctx);
 
-    if((*pool_manager).node_heap == NULL)
-    {// check success, on error deallocate mgr/pool and return null
-        free((*pool_manager).pool.mem);
-        free(pool_manager);
+    if(status != ALLOC_OK)
+    {// pools still open
+        return status;
+    }
+
+#ifdef MEM_POOL_THREAD_SAFE
+    pthread_mutex_destroy(&(*ctx).store_lock);
+#endif
+    free(ctx);
+
+    return ALLOC_OK;
+}//End mem_ctx_destroy
+
+pool_pt mem_ctx_pool_open(mem_ctx_pt ctx, size_t size, alloc_policy policy)
+{
+    if(ctx == NULL)
+    {// check arguments
         return NULL;
     }
 
-    // allocate a new gap index
-    (*pool_manager).gap_ix = (gap_pt)
-            calloc(MEM_GAP_IX_INIT_CAPACITY, sizeof(gap_t));
+    _mem_store_lock(ctx);
+    pool_pt pool = _mem_pool_open(ctx, size, policy);
+    _mem_store_unlock(ctx);
 
-    if((*pool_manager).gap_ix == NULL)
-    {// check success, on error deallocate mgr/pool/heap and return null
-        free((*pool_manager).node_heap);
-        free((*pool_manager).pool.mem);
-        free(pool_manager);
+    return pool;
+}//End mem_ctx_pool_open
+
+pool_pt mem_ctx_pool_open_fixed(mem_ctx_pt ctx,
+                                size_t obj_size,
+                                unsigned num_objs)
+{
+    if(ctx == NULL)
+    {// check arguments
         return NULL;
     }
 
-    // assign all the pointers and update meta data:
-    //   initialize top node of node heap
-    (*pool_manager).node_heap[0].alloc_record.size = size;
-    (*pool_manager).node_heap[0].alloc_record.mem = (*pool_manager).pool.mem;
-    (*pool_manager).node_heap[0].used = 1;
-    (*pool_manager).node_heap[0].allocated = 0;
-    (*pool_manager).used_nodes = 1;
-    (*pool_manager).total_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
-
-    //   initialize top node of gap index
-    (*pool_manager).gap_ix[0].node = &(*pool_manager).node_heap[0];
-    (*pool_manager).gap_ix[0].size =
-            (*pool_manager).node_heap[0].alloc_record.size;
-    (*pool_manager).gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
+    _mem_store_lock(ctx);
+    pool_pt pool = _mem_pool_open_fixed(ctx, obj_size, num_objs);
+    _mem_store_unlock(ctx);
 
-    //   initialize pool mgr
-    (*pool_manager).pool.policy = policy;
-    (*pool_manager).pool.total_size = size;
-    (*pool_manager).pool.alloc_size = 0;
-    (*pool_manager).pool.num_allocs = 0;
-    (*pool_manager).pool.num_gaps = 1;
+    return pool;
+}//End mem_ctx_pool_open_fixed
 
-    //   link pool mgr to pool store
-    pool_store[pool_store_size] = pool_manager;
-    pool_store_size++;
+pool_pt mem_ctx_pool_open_sharded(mem_ctx_pt ctx,
+                                  size_t size,
+                                  alloc_policy policy,
+                                  unsigned num_shards)
+{
+    if(ctx == NULL)
+    {// check arguments
+        return NULL;
+    }
 
-    // return the address of the mgr, cast to (pool_pt)
-    return (pool_pt) pool_manager;
+    _mem_store_lock(ctx);
+    pool_pt pool = _mem_pool_open_sharded(ctx, size, policy, num_shards);
+    _mem_store_unlock(ctx);
 
-}//End mem_pool_open
+    return pool;
+}//End mem_ctx_pool_open_sharded
 
 alloc_status mem_pool_close(pool_pt pool)
 {
-    // get mgr from pool by casting the pointer to (pool_mgr_pt)
-    pool_mgr_pt pool_manger = (pool_mgr_pt) pool;
-
-    if(pool_manger == NULL)
+    if(pool == NULL)
     {// check if this pool is allocated
         return ALLOC_NOT_FREED;
     }
 
-    if((*pool_manger).pool.num_gaps != 1)
-    {// check if pool has only one gap
-        return ALLOC_NOT_FREED;
-    }
+#ifdef MEM_POOL_THREAD_SAFE
+    // this thread's cached blocks go back first, other threads' must be
+    // flushed already
+    _mem_tcache_flush(_mem_tcache_get((pool_mgr_pt) pool, 0));
 
-    if((*pool_manger).pool.num_allocs != 0)
-    {// check if it has zero allocations
-        return ALLOC_NOT_FREED;
+    for(unsigned shard = 0;
+        shard < _mem_shard_count((pool_mgr_pt) pool);
+        shard++)
+    {// and queued remote frees are done
+        _mem_write_begin(_mem_shard_at((pool_mgr_pt) pool, shard));
+        _mem_write_end(_mem_shard_at((pool_mgr_pt) pool, shard));
     }
+#endif
 
-    // free memory pool
-    free((*pool).mem);
+    // no other thread may be using the pool while it is closed
+    mem_ctx_pt ctx = (*(pool_mgr_pt) pool).ctx;
+    _mem_store_lock(ctx);
+    alloc_status status = _mem_pool_close(pool);
+    _mem_store_unlock(ctx);
 
-    // free node heap
-    free((*pool_manger).node_heap);
-    (*pool_manger).node_heap = NULL;
+    return status;
+}//End mem_pool_close
 
-    // free gap index
-    free((*pool_manger).gap_ix);
-    (*pool_manger).gap_ix = NULL;
+alloc_status mem_pool_reset(pool_pt pool)
+{
+    // get the mgr from the pool
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
 
-    for(int parser = 0; parser < pool_store_capacity; parser++)
-    {// find mgr in pool store and set to null
-        if(pool_store[parser] == pool_manger)
+    if(pool_manager == NULL)
+    {// check arguments
+        return ALLOC_FAIL;
+    }
+
+    if(_mem_tcache_on(pool_manager))
+    {// threads may hold blocks of any shard in their caches
+        return ALLOC_FAIL;
+    }
+
+    alloc_status status = ALLOC_OK;
+    for(unsigned ix = 0; ix < _mem_shard_count(pool_manager); ix++)
+    {// every shard in turn (a plain pool is its only shard)
+        pool_mgr_pt shard = _mem_shard_at(pool_manager, ix);
+        _mem_write_begin(shard);
+        if(_mem_pool_reset(&(*shard).pool) != ALLOC_OK)
         {
-            pool_store[parser] = NULL;
-            parser = pool_store_capacity;
+            status = ALLOC_FAIL;
         }
+        _mem_write_end(shard);
     }
 
-    // free mgr
-    free(pool_manger);
+    return status;
+}//End mem_pool_reset
 
-    return ALLOC_OK;
-}//End mem_pool_close
+alloc_status mem_pool_mark(pool_pt pool, mem_pool_mark_t *mark)
+{
+    if(pool == NULL || mark == NULL)
+    {// check arguments
+        return ALLOC_FAIL;
+    }
 
-alloc_pt mem_new_alloc(pool_pt pool, size_t size)
+    _mem_lock((pool_mgr_pt) pool);
+    alloc_status status = _mem_pool_mark(pool, mark);
+    _mem_unlock((pool_mgr_pt) pool);
+
+    return status;
+}//End mem_pool_mark
+
+alloc_status mem_pool_rewind(pool_pt pool, mem_pool_mark_t mark)
 {
-    // get mgr from pool by casting the pointer to (pool_mgr_pt)
-    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+    if(pool == NULL)
+    {// check arguments
+        return ALLOC_FAIL;
+    }
 
-    if((*pool_manager).pool.num_gaps == 0)
-    {// check if any gaps, return null if none
-        return NULL;
+    if(_mem_tcache_on((pool_mgr_pt) pool))
+    {// threads may hold blocks past the mark in their caches
+        return ALLOC_FAIL;
     }
 
-    // expand heap node, if necessary, quit on error
-    _mem_resize_node_heap(pool_manager);
+    _mem_write_begin((pool_mgr_pt) pool);
+    alloc_status status = _mem_pool_rewind(pool, mark);
+    _mem_write_end((pool_mgr_pt) pool);
 
-    // get a node for allocation:
-    node_pt alloc_node = NULL;
-
-    if((*pool_manager).pool.policy == FIRST_FIT)
-    {// FIRST_FIT,
-        for(int parser = 0; parser < (*pool_manager).total_nodes; parser++)
-        {//find the first sufficient node in the node heap
-            alloc_node = &(*pool_manager).node_heap[parser];
-            if((*alloc_node).used && !(*alloc_node).allocated &&
-               (*alloc_node).alloc_record.size >= size)
-            {
-                parser = (*pool_manager).total_nodes;
-            }
-        }
-        if((*alloc_node).alloc_record.size < size)
-        {//last node wan't big enough, couldn't find a good node
-            alloc_node = NULL;
-        }
+    return status;
+}//End mem_pool_rewind
+
+alloc_status mem_pool_compact(pool_pt pool, pool_compact_pt report)
+{
+    // get the mgr from the pool
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+
+    if(pool_manager == NULL)
+    {// check arguments
+        return ALLOC_FAIL;
     }
-    else if((*pool_manager).pool.policy == BEST_FIT)
-    {// BEST_FIT,
-        for(int parser=0; parser < (*pool_manager).gap_ix_capacity; parser++)
-        {//find the first sufficient node in the gap index
-            if((*pool_manager).gap_ix[parser].size >= size)
-            {
-                alloc_node = (*pool_manager).gap_ix[parser].node;
-                parser = (*pool_manager).gap_ix_capacity;
-            }
+
+    if(_mem_tcache_on(pool_manager))
+    {// threads use their cached blocks without the lock
+        return ALLOC_FAIL;
+    }
+
+    struct timespec start;
+    timespec_get(&start, TIME_UTC);
+
+    pool_compact_t totals = {0, 0, 0};
+    alloc_status status = ALLOC_OK;
+    for(unsigned ix = 0; ix < _mem_shard_count(pool_manager); ix++)
+    {// each shard compacts in its own slice (a plain pool is its only shard)
+        pool_mgr_pt shard = _mem_shard_at(pool_manager, ix);
+        _mem_write_begin(shard);
+        if(_mem_pool_compact(&(*shard).pool, &totals) != ALLOC_OK)
+        {
+            status = ALLOC_FAIL;
         }
+        _mem_write_end(shard);
     }
+    totals.nanoseconds = _mem_elapsed_ns(&start);
 
-    if(alloc_node == NULL)
-    {// check if node found
-        return NULL;
+    if(report != NULL)
+    {// "return" the totals
+        *report = totals;
     }
 
-    // update metadata (num_allocs, alloc_size)
-    (*pool_manager).pool.num_allocs++;
-    (*pool_manager).pool.alloc_size += size;
+    return status;
+}//End mem_pool_compact
 
-    // calculate the size of the remaining gap, if any
-    size_t remaining_gap_size = (*alloc_node).alloc_record.size - size;
+alloc_status mem_pool_compact_step(pool_pt pool,
+                                   size_t max_bytes,
+                                   unsigned long max_ns,
+                                   pool_compact_pt report)
+{
+    // get the mgr from the pool
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
 
-    // remove node from gap index
-    _mem_remove_from_gap_ix(pool_manager, size, alloc_node);
+    if(pool_manager == NULL)
+    {// check arguments
+        return ALLOC_FAIL;
+    }
 
-    // convert gap_node to an allocation node of given size
-    (*alloc_node).allocated = 1;
-    (*alloc_node).alloc_record.size = size;
+    if(_mem_tcache_on(pool_manager))
+    {// threads use their cached blocks without the lock
+        return ALLOC_FAIL;
+    }
 
-    // adjust node heap:
-    if(remaining_gap_size != 0)
-    {//   if remaining gap, need a new node
-        node_pt unused_node = NULL;
-        for(int parser = 0; parser < (*pool_manager).total_nodes; parser++)
-        {//   find an unused one in the node heap
-            if((*pool_manager).node_heap[parser].used == 0)
-            {
-                unused_node = &(*pool_manager).node_heap[parser];
-                parser = (*pool_manager).total_nodes;
-            }
-        }
+    struct timespec start;
+    timespec_get(&start, TIME_UTC);
 
-        if(unused_node == NULL)
-        {//   make sure one was found
-            return NULL;
+    pool_compact_t totals = {0, 0, 0};
+    alloc_status status = ALLOC_OK;
+    for(unsigned ix = 0;
+        ix < _mem_shard_count(pool_manager) &&
+        _mem_compact_budget_left(max_bytes, max_ns, &start, &totals);
+        ix++)
+    {// the shards share the budget, in order
+        pool_mgr_pt shard = _mem_shard_at(pool_manager, ix);
+        _mem_write_begin(shard);
+        if(_mem_pool_compact_step(&(*shard).pool, max_bytes, max_ns,
+                                  &start, &totals) != ALLOC_OK)
+        {
+            status = ALLOC_FAIL;
         }
+        _mem_write_end(shard);
+    }
+    totals.nanoseconds = _mem_elapsed_ns(&start);
 
-        //   initialize it to a gap node
-        (*unused_node).alloc_record.size = remaining_gap_size;
-        (*unused_node).alloc_record.mem =
-                (*alloc_node).alloc_record.mem + size;
-        (*unused_node).allocated = 0;
-        (*unused_node).used = 1;
+    if(report != NULL)
+    {// "return" the totals
+        *report = totals;
+    }
 
-        //   update metadata (used_nodes)
-        (*pool_manager).used_nodes++;
+    return status;
+}//End mem_pool_compact_step
 
-        //  update linked list (new node right after the node for allocation)
-        (*unused_node).prev = alloc_node;
-        (*unused_node).next = (*alloc_node).next;
-        if((*alloc_node).next != NULL)
-        {
-            (*(*alloc_node).next).prev = unused_node;
-        }
-        (*alloc_node).next = unused_node;
+alloc_pt mem_new_alloc(pool_pt pool, size_t size)
+{
+#ifdef MEM_POOL_THREAD_SAFE
+    alloc_pt cached = _mem_tcache_pop((pool_mgr_pt) pool, size);
+    if(cached != NULL)
+    {// served from this thread's cache, no lock taken
+        return cached;
+    }
+#endif
 
-        //   add to gap index
-        _mem_add_to_gap_ix(pool_manager, remaining_gap_size, unused_node);
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+    alloc_pt alloc = _mem_new_alloc_shards(pool_manager, size);
+
+#ifdef MEM_POOL_THREAD_SAFE
+    tcache_pt tcache = (alloc == NULL) ?
+                       _mem_tcache_get(pool_manager, 0) : NULL;
+    if(tcache != NULL)
+    {// the free space may be in this thread's cache, give it back
+        _mem_tcache_flush(tcache);
+        alloc = _mem_new_alloc_shards(pool_manager, size);
     }
+#endif
 
-    // return allocation record by casting the node to (alloc_pt)
-    return (alloc_pt) alloc_node;
+    return alloc;
 }//End mem_new_alloc
 
-alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc)
+alloc_status mem_new_alloc_batch(pool_pt pool,
+                                 const size_t *sizes,
+                                 unsigned num_allocs,
+                                 alloc_pt *allocs)
 {
-    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    if(pool == NULL || (num_allocs > 0 && (sizes == NULL || allocs == NULL)))
+    {// check arguments
+        return ALLOC_FAIL;
+    }
+
     pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+    unsigned num_shards = _mem_shard_count(pool_manager);
+    unsigned home = (num_shards > 1) ? _mem_shard_home(num_shards) : 0;
+    alloc_status status = ALLOC_FAIL;
 
-    // get node from alloc by casting the pointer to (node_pt)
-    node_pt node_to_delete = (node_pt) alloc;
+    for(unsigned tried = 0; status != ALLOC_OK && tried < num_shards; tried++)
+    {// the whole batch from one shard, the thread's own first
+        pool_mgr_pt shard =
+                _mem_shard_at(pool_manager, (home + tried) % num_shards);
+        _mem_write_begin(shard);
+        status = _mem_new_alloc_batch(&(*shard).pool, sizes, num_allocs,
+                                      allocs);
+        _mem_write_end(shard);
+    }
 
-    // convert to gap node
-    (*node_to_delete).allocated = 0;
+    return status;
+}//End mem_new_alloc_batch
 
-    // update metadata (num_allocs, alloc_size)
-    (*pool_manager).pool.num_allocs--;
-    (*pool_manager).pool.alloc_size -= (*alloc).size;
+alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc)
+{
+#ifdef MEM_POOL_THREAD_SAFE
+    if(_mem_tcache_push((pool_mgr_pt) pool, alloc) == ALLOC_OK)
+    {// kept in this thread's cache, no lock taken
+        return ALLOC_OK;
+    }
+#endif
 
-    if((*node_to_delete).next != NULL &&
-       (*(*node_to_delete).next).allocated == 0)
-    {//the next node in the list is also a gap, merge into node-to-delete
-        //   remove the next node from gap index
-        _mem_remove_from_gap_ix(pool_manager,
-                                (*(*node_to_delete).next).alloc_record.size,
-                                (*node_to_delete).next);
+    // the shard the block came from (a plain pool is its only shard)
+    pool_mgr_pt shard = _mem_shard_of((pool_mgr_pt) pool, alloc);
 
-        //   add the size to the node-to-delete
-        (*alloc).size += (*(*node_to_delete).next).alloc_record.size;
+#ifdef MEM_POOL_THREAD_SAFE
+    if(_mem_remote_push(shard, alloc) == ALLOC_OK)
+    {// not the owner, queued for the owner to free
+        return ALLOC_OK;
+    }
+#endif
 
-        //   update node as unused
-        (*(*node_to_delete).next).used = 0;
-        (*(*node_to_delete).next).alloc_record.size = 0;
-        (*(*node_to_delete).next).alloc_record.mem = NULL;
+    _mem_write_begin(shard);
+    alloc_status status = _mem_del_alloc(&(*shard).pool, alloc);
+    _mem_write_end(shard);
 
-        //   update metadata (used nodes)
-        (*pool_manager).used_nodes--;
+    return status;
+}//End mem_del_alloc
 
-        //   update linked list:
-        if((*(*node_to_delete).next).next != NULL)
-        {//there exists a node after the next node
-            (*(*(*node_to_delete).next).next).prev = node_to_delete;
-            (*node_to_delete).next = (*(*node_to_delete).next).next;
+alloc_status mem_del_alloc_batch(pool_pt pool,
+                                 alloc_pt *allocs,
+                                 unsigned num_allocs)
+{
+    if(pool == NULL || (num_allocs > 0 && allocs == NULL))
+    {// check arguments
+        return ALLOC_FAIL;
+    }
+
+    // address order, which also groups the allocations by shard
+    _mem_sort_allocs(allocs, num_allocs, (*pool).mem, (*pool).total_size);
+
+    alloc_status status = ALLOC_OK;
+    unsigned first = 0;
+    while(first < num_allocs)
+    {// one lock and one pass per shard
+        pool_mgr_pt shard = _mem_shard_of((pool_mgr_pt) pool, allocs[first]);
+        unsigned last = first + 1;
+        while(last < num_allocs &&
+              _mem_shard_of((pool_mgr_pt) pool, allocs[last]) == shard)
+        {
+            last++;
         }
-        else
-        {//the next node is the last node
-            (*(*node_to_delete).next).prev = NULL;
-            (*node_to_delete).next = NULL;
+
+        _mem_write_begin(shard);
+        if(_mem_del_alloc_batch(&(*shard).pool, allocs + first,
+                                last - first) != ALLOC_OK)
+        {
+            status = ALLOC_FAIL;
         }
+        _mem_write_end(shard);
+
+        first = last;
     }
 
-    // this merged node-to-delete might need to be added to the gap index
-    // but one more thing to check...
+    return status;
+}//End mem_del_alloc_batch
 
-    if((*node_to_delete).prev && (*(*node_to_delete).prev).allocated == 0)
-    {//the previous node in the list is also a gap, merge into previous!
-        node_pt prev_node = (*node_to_delete).prev;
+mem_alloc_handle_t mem_new_handle(pool_pt pool, size_t size)
+{
+    _mem_write_begin((pool_mgr_pt) pool);
+    mem_alloc_handle_t handle = _mem_new_handle(pool, size);
+    _mem_write_end((pool_mgr_pt) pool);
 
-        //   remove the previous node from gap index
-        alloc_status remove_status =
-                _mem_remove_from_gap_ix(pool_manager,
-                                        (*prev_node).alloc_record.size,
+    return handle;
+}//End mem_new_handle
+
+char *mem_handle_mem(pool_pt pool, mem_alloc_handle_t handle)
+{
+    _mem_lock((pool_mgr_pt) pool);
+    node_pt node = _mem_handle_node((pool_mgr_pt) pool, handle);
+    char *mem = (node != NULL) ? (*node).alloc_record.mem : NULL;
+    _mem_unlock((pool_mgr_pt) pool);
+
+    return mem;
+}//End mem_handle_mem
+
+alloc_status mem_del_handle(pool_pt pool, mem_alloc_handle_t handle)
+{
+    _mem_write_begin((pool_mgr_pt) pool);
+    alloc_status status = _mem_del_handle(pool, handle);
+    _mem_write_end((pool_mgr_pt) pool);
+
+    return status;
+}//End mem_del_handle
+
+void mem_inspect_pool(pool_pt pool,
+                      pool_segment_pt *segments,
+                      unsigned *num_segments)
+{
+    if((*(pool_mgr_pt) pool).shards != NULL)
+    {// one shard at a time, their segments in address order
+        _mem_shards_inspect((pool_mgr_pt) pool, segments, num_segments);
+        return;
+    }
+
+    _mem_lock((pool_mgr_pt) pool);
+    _mem_inspect_pool(pool, segments, num_segments);
+    _mem_unlock((pool_mgr_pt) pool);
+}//End mem_inspect_pool
+
+alloc_status mem_pool_stats(pool_pt pool, pool_stats_pt stats)
+{
+    // get the mgr from the pool
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+
+    if(pool_manager == NULL || stats == NULL)
+    {// check arguments
+        return ALLOC_FAIL;
+    }
+
+    memset(stats, 0, sizeof(pool_stats_t));
+
+    for(unsigned ix = 0; ix < _mem_shard_count(pool_manager); ix++)
+    {// node heap usage and churn (all zero for FIXED pools), summed
+        pool_mgr_pt shard = _mem_shard_at(pool_manager, ix);
+        _mem_lock(shard);
+        (*stats).total_nodes += (*shard).total_nodes;
+        (*stats).used_nodes += (*shard).used_nodes;
+        (*stats).node_reuses += (*shard).node_reuses;
+        (*stats).node_releases += (*shard).node_releases;
+        (*stats).quick_blocks += (*shard).quick_blocks;
+        (*stats).remote_frees += (*shard).remote_frees;
+        _mem_unlock(shard);
+    }
+
+    return ALLOC_OK;
+}//End mem_pool_stats
+
+alloc_status mem_pool_snapshot(pool_pt pool, pool_pt snapshot)
+{
+    // get the mgr from the pool
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+
+    if(pool_manager == NULL || snapshot == NULL)
+    {// check arguments
+        return ALLOC_FAIL;
+    }
+
+    if((*pool_manager).shards == NULL)
+    {// one pool, one consistent copy
+        _mem_read_pool(pool_manager, snapshot);
+        return ALLOC_OK;
+    }
+
+    // sharded: each shard's counters are consistent, the sums may mix
+    // moments if other threads are allocating
+    (*snapshot).mem = (*pool_manager).pool.mem;
+    (*snapshot).policy = (*pool_manager).pool.policy;
+    (*snapshot).total_size = (*pool_manager).pool.total_size;
+    (*snapshot).alloc_size = 0;
+    (*snapshot).num_allocs = 0;
+    (*snapshot).num_gaps = 0;
+
+    for(unsigned ix = 0; ix < (*pool_manager).num_shards; ix++)
+    {
+        pool_t shard;
+        _mem_read_pool((*pool_manager).shards[ix], &shard);
+        (*snapshot).alloc_size += shard.alloc_size;
+        (*snapshot).num_allocs += shard.num_allocs;
+        (*snapshot).num_gaps += shard.num_gaps;
+    }
+
+    return ALLOC_OK;
+}//End mem_pool_snapshot
+
+alloc_status mem_pool_set_quick_lists(pool_pt pool, size_t max_size)
+{
+    alloc_status status = ALLOC_OK;
+
+    for(unsigned ix = 0;
+        status == ALLOC_OK && ix < _mem_shard_count((pool_mgr_pt) pool);
+        ix++)
+    {// every shard gets its own lists
+        pool_mgr_pt shard = _mem_shard_at((pool_mgr_pt) pool, ix);
+        _mem_write_begin(shard);
+        status = _mem_pool_set_quick_lists(&(*shard).pool, max_size);
+        _mem_write_end(shard);
+    }
+
+    return status;
+}//End mem_pool_set_quick_lists
+
+alloc_status mem_pool_flush_quick_lists(pool_pt pool)
+{
+    alloc_status status = ALLOC_OK;
+
+    for(unsigned ix = 0;
+        status == ALLOC_OK && ix < _mem_shard_count((pool_mgr_pt) pool);
+        ix++)
+    {
+        pool_mgr_pt shard = _mem_shard_at((pool_mgr_pt) pool, ix);
+        _mem_write_begin(shard);
+        status = _mem_pool_flush_quick_lists(&(*shard).pool);
+        _mem_write_end(shard);
+    }
+
+    return status;
+}//End mem_pool_flush_quick_lists
+
+alloc_status mem_pool_set_thread_cache(pool_pt pool, unsigned enabled)
+{
+#ifdef MEM_POOL_THREAD_SAFE
+    // get the mgr from the pool
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+
+    if(pool_manager == NULL ||
+       (*pool_manager).pool.policy == BUDDY ||
+       (*pool_manager).pool.policy == FIXED ||
+       (*pool_manager).pool.policy == ARENA)
+    {// BUDDY sizes are rounded, FIXED/ARENA allocations are not nodes
+        return ALLOC_FAIL;
+    }
+
+    atomic_store_explicit(&(*pool_manager).tcache_on, enabled != 0,
+                          memory_order_relaxed);
+
+    return ALLOC_OK;
+#else
+    // nothing to gain without locks to skip
+    (void) pool;
+    (void) enabled;
+    return ALLOC_FAIL;
+#endif
+}//End mem_pool_set_thread_cache
+
+alloc_status mem_thread_cache_flush(pool_pt pool)
+{
+    if(pool == NULL)
+    {// check arguments
+        return ALLOC_FAIL;
+    }
+
+#ifdef MEM_POOL_THREAD_SAFE
+    _mem_tcache_flush(_mem_tcache_get((pool_mgr_pt) pool, 0));
+#endif
+
+    return ALLOC_OK;
+}//End mem_thread_cache_flush
+
+alloc_status mem_pool_set_remote_free(pool_pt pool, unsigned enabled)
+{
+#ifdef MEM_POOL_THREAD_SAFE
+    // get the mgr from the pool
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+
+    if(pool_manager == NULL ||
+       (*pool_manager).pool.policy == FIXED ||
+       (*pool_manager).pool.policy == ARENA)
+    {// FIXED and ARENA allocations are not nodes, there is nothing to link
+        return ALLOC_FAIL;
+    }
+
+    for(unsigned ix = 0; ix < _mem_shard_count(pool_manager); ix++)
+    {// every shard has its own queue, queued blocks are freed first
+        pool_mgr_pt shard = _mem_shard_at(pool_manager, ix);
+        _mem_write_begin(shard);
+        (*shard).owner = pthread_self();
+        atomic_store_explicit(&(*shard).remote_on, enabled != 0,
+                              memory_order_release);
+        _mem_write_end(shard);
+    }
+
+    return ALLOC_OK;
+#else
+    // every free is on the one thread
+    (void) pool;
+    (void) enabled;
+    return ALLOC_FAIL;
+#endif
+}//End mem_pool_set_remote_free
+
+
+
+/***********************************/
+/*                                 */
+/* Definitions of static functions */
+/*                                 */
+/***********************************/
+static alloc_status _mem_init(mem_ctx_pt ctx)
+{
+    if((*ctx).pool_store == NULL)
+    {// allocate the pool store with initial capacity
+        (*ctx).pool_store = (pool_mgr_pt*)
+                calloc(MEM_POOL_STORE_INIT_CAPACITY, sizeof(pool_mgr_pt));
+        (*ctx).pool_store_size = 0;
+        (*ctx).pool_store_capacity = MEM_POOL_STORE_INIT_CAPACITY;
+        return ALLOC_OK;
+    }
+    else
+    {// ensure that it's called only once until mem_free
+        return ALLOC_CALLED_AGAIN;
+    }
+}//End _mem_init
+
+static alloc_status _mem_free(mem_ctx_pt ctx)
+{
+    if((*ctx).pool_store == NULL)
+    {// ensure that it's called only once for each mem_init
+        return ALLOC_CALLED_AGAIN;
+    }
+
+    if((*ctx).pool_store_size != 0)
+    {// make sure all pool managers have been deallocated
+        return ALLOC_FAIL;
+    }
+
+    // can free the pool store array
+    free((*ctx).pool_store);
+
+    // update the context
+    (*ctx).pool_store = NULL;
+    (*ctx).pool_store_size = 0;
+    (*ctx).pool_store_capacity = 0;
+    return ALLOC_OK;
+
+}//End _mem_free
+
+static pool_pt
+    _mem_pool_open(mem_ctx_pt ctx,
+                   size_t size,
+                   alloc_policy policy)
+{
+    if((*ctx).pool_store == NULL)
+    {// make sure there the pool store is allocated
+        return NULL;
+    }
+
+    if(policy == FIXED || size > MEM_GAP_OFF_MAX)
+    {// FIXED pools need an object size, see mem_pool_open_fixed, and the
+     // gap index must be able to hold the size
+        return NULL;
+    }
+
+    // expand the pool store, if necessary
+    if(_mem_resize_pool_store(ctx) != ALLOC_OK)
+    {// check success
+        return NULL;
+    }
+
+    // allocate a new memory pool
+    char *mem = (char*) calloc(size, sizeof(char));
+
+    if(mem == NULL)
+    {// check success, on error return null
+        return NULL;
+    }
+
+    // allocate a new mem pool mgr over it
+    pool_mgr_pt pool_manager = _mem_pool_create(mem, size, policy);
+
+    if(pool_manager == NULL)
+    {// check success, on error deallocate pool and return null
+        free(mem);
+        return NULL;
+    }
+
+    //   link pool mgr to pool store
+    _mem_store_add(ctx, pool_manager);
+
+    // return the address of the mgr, cast to (pool_pt)
+    return (pool_pt) pool_manager;
+
+}//End _mem_pool_open
+
+static pool_mgr_pt _mem_pool_create(char *mem, size_t size, alloc_policy policy)
+{
+    // allocate a new mem pool mgr
+    pool_mgr_pt pool_manager = calloc(1, sizeof(pool_mgr_t));
+
+    if(pool_manager == NULL)
+    {// check success, on error return null
+        return NULL;
+    }
+
+    // the memory is the caller's
+    (*pool_manager).pool.mem = mem;
+
+    if(policy == ARENA)
+    {// ARENA, no node heap or gap index, just a bump offset
+        (*pool_manager).pool.policy = ARENA;
+        (*pool_manager).pool.total_size = size;
+        if(_mem_arena_init(pool_manager) != ALLOC_OK)
+        {// check success, on error deallocate mgr and return null
+            free(pool_manager);
+            return NULL;
+        }
+
+        //   set up the pool lock (thread-safe builds)
+        _mem_init_lock(pool_manager);
+
+        return pool_manager;
+    }
+
+    // allocate a new node heap with its first chunk
+    (*pool_manager).node_heap = (node_pt*)
+            calloc(MEM_NODE_HEAP_INIT_CHUNKS, sizeof(node_pt));
+    (*pool_manager).node_heap_capacity = MEM_NODE_HEAP_INIT_CHUNKS;
+
+    if((*pool_manager).node_heap == NULL ||
+       _mem_expand_node_heap(pool_manager) != ALLOC_OK)
+    {// check success, on error deallocate mgr/heap and return null
+        _mem_free_node_heap(pool_manager);
+        free(pool_manager);
+        return NULL;
+    }
+
+    // allocate a new gap index
+    (*pool_manager).gap_ix = (gap_pt)
+            calloc(MEM_GAP_IX_INIT_CAPACITY, sizeof(gap_t));
+
+    if((*pool_manager).gap_ix == NULL)
+    {// check success, on error deallocate mgr/heap and return null
+        _mem_free_node_heap(pool_manager);
+        free(pool_manager);
+        return NULL;
+    }
+
+    if(policy == TLSF || policy == BUDDY)
+    {// allocate the segregated free lists
+        (*pool_manager).tlsf = (tlsf_pt) calloc(1, sizeof(tlsf_t));
+
+        if((*pool_manager).tlsf == NULL)
+        {// check success, on error deallocate mgr/heap/ix
+            free((*pool_manager).gap_ix);
+            _mem_free_node_heap(pool_manager);
+            free(pool_manager);
+            return NULL;
+        }
+    }
+
+    // assign all the pointers and update meta data:
+    //   chain all slots of the gap index into the free list
+    for(unsigned slot = 0; slot < MEM_GAP_IX_INIT_CAPACITY; slot++)
+    {
+        (*pool_manager).gap_ix[slot].node = MEM_GAP_IX_NIL;
+        (*pool_manager).gap_ix[slot].left =
+                (slot + 1 < MEM_GAP_IX_INIT_CAPACITY) ?
+                slot + 1 : MEM_GAP_IX_NIL;
+    }
+    (*pool_manager).gap_ix_free = 0;
+    (*pool_manager).gap_ix_root = MEM_GAP_IX_NIL;
+    (*pool_manager).gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
+
+    //   initialize pool mgr
+    (*pool_manager).pool.policy = policy;
+    (*pool_manager).pool.total_size = size;
+    (*pool_manager).pool.alloc_size = 0;
+    (*pool_manager).pool.num_allocs = 0;
+    (*pool_manager).pool.num_gaps = 0;
+    (*pool_manager).rover = (*pool_manager).pool.mem;
+
+    if(policy == BUDDY)
+    {//   carve the pool into power-of-two top blocks (sets num_gaps)
+        if(_mem_buddy_init(pool_manager) != ALLOC_OK)
+        {
+            free((*pool_manager).tlsf);
+            free((*pool_manager).gap_ix);
+            _mem_free_node_heap(pool_manager);
+            free(pool_manager);
+            return NULL;
+        }
+    }
+    else
+    {//   initialize top node of node heap
+        node_pt top_node = _mem_get_unused_node(pool_manager);
+        (*top_node).alloc_record.size = size;
+        (*top_node).alloc_record.mem = (*pool_manager).pool.mem;
+        (*top_node).allocated = 0;
+        (*pool_manager).head_node = top_node;
+        (*pool_manager).tail_node = top_node;
+
+        //   add top node to the gap index (sets num_gaps)
+        _mem_add_to_gap_ix(pool_manager, size, top_node);
+    }
+
+    //   set up the pool lock (thread-safe builds)
+    _mem_init_lock(pool_manager);
+
+    return pool_manager;
+}//End _mem_pool_create
+
+static pool_pt
+    _mem_pool_open_fixed(mem_ctx_pt ctx,
+                         size_t obj_size,
+                         unsigned num_objs)
+{
+    if((*ctx).pool_store == NULL)
+    {// make sure there the pool store is allocated
+        return NULL;
+    }
+
+    // round the object size up so a free object can hold the list link
+    size_t stride = (obj_size < sizeof(char *)) ? sizeof(char *) : obj_size;
+    stride = (stride + sizeof(char *) - 1) / sizeof(char *) * sizeof(char *);
+    if(num_objs == 0 || stride < obj_size || stride > SIZE_MAX / num_objs)
+    {// check the pool size is representable
+        return NULL;
+    }
+
+    // expand the pool store, if necessary
+    if(_mem_resize_pool_store(ctx) != ALLOC_OK)
+    {// check success
+        return NULL;
+    }
+
+    // allocate a new mem pool mgr
+    pool_mgr_pt pool_manager = calloc(1, sizeof(pool_mgr_t));
+
+    if(pool_manager == NULL)
+    {// check success, on error return null
+        return NULL;
+    }
+
+    // allocate the slab descriptor and the allocation records
+    (*pool_manager).slab = (slab_pt) calloc(1, sizeof(slab_t));
+
+    if((*pool_manager).slab == NULL)
+    {// check success, on error deallocate mgr and return null
+        free(pool_manager);
+        return NULL;
+    }
+
+    slab_pt slab = (*pool_manager).slab;
+    (*slab).records = (alloc_pt) calloc(num_objs, sizeof(alloc_t));
+
+    if((*slab).records == NULL)
+    {// check success, on error deallocate mgr/slab and return null
+        free(slab);
+        free(pool_manager);
+        return NULL;
+    }
+
+    // allocate a new memory pool
+    (*pool_manager).pool.mem = (char*) calloc(num_objs, stride);
+
+    if((*pool_manager).pool.mem == NULL)
+    {// check success, on error deallocate mgr/slab/records, return null
+        free((*slab).records);
+        free(slab);
+        free(pool_manager);
+        return NULL;
+    }
+
+    // objects are carved off the pool lazily, so nothing to link yet
+    (*slab).obj_size = stride;
+    (*slab).num_objs = num_objs;
+    (*slab).num_carved = 0;
+    (*slab).free_list = NULL;
+
+    //   initialize pool mgr
+    (*pool_manager).pool.policy = FIXED;
+    (*pool_manager).pool.total_size = stride * num_objs;
+    (*pool_manager).pool.alloc_size = 0;
+    (*pool_manager).pool.num_allocs = 0;
+    (*pool_manager).pool.num_gaps = 1;
+
+    //   set up the pool lock (thread-safe builds)
+    _mem_init_lock(pool_manager);
+
+    //   link pool mgr to pool store
+    _mem_store_add(ctx, pool_manager);
+
+    // return the address of the mgr, cast to (pool_pt)
+    return (pool_pt) pool_manager;
+
+}//End _mem_pool_open_fixed
+
+static pool_pt
+    _mem_pool_open_sharded(mem_ctx_pt ctx,
+                           size_t size,
+                           alloc_policy policy,
+                           unsigned num_shards)
+{
+    if((*ctx).pool_store == NULL)
+    {// make sure there the pool store is allocated
+        return NULL;
+    }
+
+    if(policy == FIXED || policy == ARENA || num_shards == 0 ||
+       size / num_shards < MEM_SHARD_ALIGN || size > MEM_GAP_OFF_MAX)
+    {// FIXED and ARENA pools are not split, every shard needs some memory
+        return NULL;
+    }
+
+    if(num_shards == 1)
+    {// nothing to split
+        return _mem_pool_open(ctx, size, policy);
+    }
+
+    // expand the pool store, if necessary
+    if(_mem_resize_pool_store(ctx) != ALLOC_OK)
+    {// check success
+        return NULL;
+    }
+
+    // allocate the mgr of the whole pool, it has no node heap of its own
+    pool_mgr_pt pool_manager = calloc(1, sizeof(pool_mgr_t));
+
+    if(pool_manager == NULL)
+    {// check success, on error return null
+        return NULL;
+    }
+
+    // allocate a new memory pool and the shard array
+    char *mem = (char*) calloc(size, sizeof(char));
+    pool_mgr_pt *shards = (pool_mgr_pt*)
+            calloc(num_shards, sizeof(pool_mgr_pt));
+
+    if(mem == NULL || shards == NULL)
+    {// check success, on error deallocate mgr/pool/shards, return null
+        free(shards);
+        free(mem);
+        free(pool_manager);
+        return NULL;
+    }
+
+    // shards start on MEM_SHARD_ALIGN boundaries, the last takes the rest
+    size_t shard_size = size / num_shards / MEM_SHARD_ALIGN * MEM_SHARD_ALIGN;
+
+    for(unsigned shard = 0; shard < num_shards; shard++)
+    {// each shard is a pool of its own over its slice of the memory
+        size_t offset = shard * shard_size;
+        shards[shard] = _mem_pool_create(mem + offset,
+                                         (shard + 1 < num_shards) ?
+                                         shard_size : size - offset,
+                                         policy);
+
+        if(shards[shard] == NULL)
+        {// check success, on error deallocate everything so far
+            while(shard-- > 0)
+            {
+                _mem_pool_destroy(shards[shard]);
+            }
+            free(shards);
+            free(mem);
+            free(pool_manager);
+            return NULL;
+        }
+        (*pool_manager).pool.num_gaps += (*shards[shard]).pool.num_gaps;
+    }
+
+    //   initialize pool mgr
+    (*pool_manager).pool.mem = mem;
+    (*pool_manager).pool.policy = policy;
+    (*pool_manager).pool.total_size = size;
+    (*pool_manager).pool.alloc_size = 0;
+    (*pool_manager).pool.num_allocs = 0;
+    (*pool_manager).shards = shards;
+    (*pool_manager).num_shards = num_shards;
+    (*pool_manager).shard_size = shard_size;
+
+    //   set up the pool lock (thread-safe builds)
+    _mem_init_lock(pool_manager);
+
+    //   link pool mgr to pool store
+    _mem_store_add(ctx, pool_manager);
+
+    // return the address of the mgr, cast to (pool_pt)
+    return (pool_pt) pool_manager;
+
+}//End _mem_pool_open_sharded
+
+static alloc_status _mem_pool_close(pool_pt pool)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_manger = (pool_mgr_pt) pool;
+
+    if(pool_manger == NULL)
+    {// check if this pool is allocated
+        return ALLOC_NOT_FREED;
+    }
+
+    for(unsigned shard = 0; shard < _mem_shard_count(pool_manger); shard++)
+    {// check every shard is empty (a plain pool is its only shard)
+        if(!_mem_pool_is_empty(_mem_shard_at(pool_manger, shard)))
+        {
+            return ALLOC_NOT_FREED;
+        }
+    }
+
+    // free memory pool
+    free((*pool).mem);
+
+    if((*pool_manger).shards != NULL)
+    {// free the shard mgrs, their memory was part of the pool's
+        for(unsigned shard = 0; shard < (*pool_manger).num_shards; shard++)
+        {
+            _mem_pool_destroy((*pool_manger).shards[shard]);
+        }
+        free((*pool_manger).shards);
+        (*pool_manger).shards = NULL;
+    }
+
+    // unlink mgr from pool store
+    _mem_store_remove(pool_manger);
+
+    // free the mgr and everything it owns but the memory pool
+    _mem_pool_destroy(pool_manger);
+
+    return ALLOC_OK;
+}//End _mem_pool_close
+
+static int _mem_pool_is_empty(pool_mgr_pt pool_mgr)
+{
+    // cached blocks are free, merge them back before checking
+    _mem_pool_flush_quick_lists(&(*pool_mgr).pool);
+
+    // BUDDY has a gap per top block, and a 0-byte ARENA pool has none
+    if((*pool_mgr).pool.policy != BUDDY &&
+       (*pool_mgr).pool.policy != ARENA &&
+       (*pool_mgr).pool.num_gaps != 1)
+    {// check if pool has only one gap
+        return 0;
+    }
+
+    // check if it has zero allocations
+    return (*pool_mgr).pool.num_allocs == 0;
+}//End _mem_pool_is_empty
+
+static alloc_status _mem_pool_reset(pool_pt pool)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+
+    if((*pool_manager).pool.policy != ARENA)
+    {// node pools rewind to the start of the pool
+        return _mem_pool_rewind(pool, 0);
+    }
+
+    // rewind the bump offset, the record chunks stay for reuse
+    (*(*pool_manager).arena).offset = 0;
+    (*(*pool_manager).arena).num_records = 0;
+
+    // update metadata (the pool is one gap again)
+    (*pool_manager).pool.alloc_size = 0;
+    (*pool_manager).pool.num_allocs = 0;
+    (*pool_manager).pool.num_gaps = ((*pool_manager).pool.total_size > 0);
+
+    return ALLOC_OK;
+}//End _mem_pool_reset
+
+static alloc_status _mem_pool_mark(pool_pt pool, mem_pool_mark_t *mark)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+
+    if((*pool_manager).pool.policy == BUDDY ||
+       (*pool_manager).pool.policy == FIXED ||
+       (*pool_manager).shards != NULL)
+    {// no single tail gap to mark
+        return ALLOC_FAIL;
+    }
+
+    if((*pool_manager).pool.policy == ARENA)
+    {// ARENA, the bump offset
+        *mark = (*(*pool_manager).arena).offset;
+        return ALLOC_OK;
+    }
+
+    // the start of the tail gap, the end of the pool if there is none
+    node_pt tail_node = (*pool_manager).tail_node;
+    *mark = ((*tail_node).allocated == 0) ?
+            (size_t) ((*tail_node).alloc_record.mem - (*pool).mem) :
+            (*pool).total_size;
+
+    return ALLOC_OK;
+}//End _mem_pool_mark
+
+// Free everything that starts at or reaches past the mark: cut the node
+// list there, walking back from the tail, and make the rest one gap.
+static alloc_status _mem_pool_rewind(pool_pt pool, mem_pool_mark_t mark)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+
+    if((*pool_manager).pool.policy == BUDDY ||
+       (*pool_manager).pool.policy == FIXED ||
+       (*pool_manager).shards != NULL ||
+       mark > (*pool).total_size)
+    {// no single tail gap to rebuild, or not a mark of this pool
+        return ALLOC_FAIL;
+    }
+
+    if((*pool_manager).pool.policy == ARENA)
+    {// ARENA, pull the bump offset back
+        _mem_arena_rewind(pool_manager, mark);
+        return ALLOC_OK;
+    }
+
+    // cached blocks past the mark have to come off the quick lists
+    _mem_pool_flush_quick_lists(pool);
+
+    // find the first node past the mark
+    char *mark_mem = (*pool).mem + mark;
+    node_pt cut_node = NULL;
+    node_pt node = (*pool_manager).tail_node;
+    while(node != NULL &&
+          ((*node).alloc_record.mem >= mark_mem ||
+           (*node).alloc_record.mem + (*node).alloc_record.size > mark_mem))
+    {
+        cut_node = node;
+        node = (*node).prev;
+    }
+
+    if(cut_node == NULL)
+    {// nothing past the mark
+        return ALLOC_OK;
+    }
+
+    // the tail gap starts at the cut, or at a gap right before it
+    node_pt gap_node = cut_node;
+    if(node != NULL && (*node).allocated == 0)
+    {
+        _mem_remove_from_gap_ix(pool_manager,
+                                (*node).alloc_record.size,
+                                node);
+        gap_node = node;
+    }
+
+    for(node = cut_node; node != NULL; )
+    {// retire every node past the mark
+        node_pt next_node = (*node).next;
+
+        if((*node).allocated)
+        {// outstanding handles go stale, update metadata
+            (*node).generation++;
+            (*pool_manager).pool.num_allocs--;
+            (*pool_manager).pool.alloc_size -= (*node).alloc_record.size;
+        }
+        else
+        {// a gap, out of the gap index
+            _mem_remove_from_gap_ix(pool_manager,
+                                    (*node).alloc_record.size,
+                                    node);
+        }
+
+        if(node != gap_node)
+        {// update node as unused (and metadata)
+            _mem_put_unused_node(pool_manager, node);
+        }
+        node = next_node;
+    }
+
+    // one gap from there to the end of the pool
+    (*gap_node).allocated = 0;
+    (*gap_node).alloc_record.size =
+            (size_t) ((*pool).mem + (*pool).total_size -
+                      (*gap_node).alloc_record.mem);
+    (*gap_node).next = NULL;
+    (*pool_manager).tail_node = gap_node;
+
+    return _mem_add_to_gap_ix(pool_manager,
+                              (*gap_node).alloc_record.size,
+                              gap_node);
+}//End _mem_pool_rewind
+
+// Slide every allocation down to the start of the pool, in list order,
+// and make the space left at the end one gap. The nodes stay where they
+// are, so alloc records and handles follow their blocks.
+static alloc_status _mem_pool_compact(pool_pt pool, pool_compact_pt report)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+
+    if((*pool_manager).pool.policy == BUDDY ||
+       (*pool_manager).pool.policy == FIXED)
+    {// blocks are tied to their place (buddy order, object slot)
+        return ALLOC_FAIL;
+    }
+
+    if((*pool_manager).pool.policy == ARENA)
+    {// ARENA, the allocations are back to back from the start already
+        return ALLOC_OK;
+    }
+
+    // cached blocks are free, they become gaps first
+    _mem_pool_flush_quick_lists(pool);
+
+    char *dest = (*pool).mem;
+    node_pt last_alloc = NULL; // last allocation relinked so far
+    node_pt tail_gap = NULL;   // a gap node kept for the end of the pool
+    node_pt node = (*pool_manager).head_node;
+    while(node != NULL)
+    {
+        node_pt next_node = (*node).next;
+
+        if((*node).allocated == 0)
+        {// a gap, all but one node released
+            if(tail_gap == NULL)
+            {
+                tail_gap = node;
+            }
+            else
+            {
+                _mem_put_unused_node(pool_manager, node);
+            }
+        }
+        else
+        {// an allocation, moved down to the end of the last one
+            if((*node).alloc_record.mem != dest)
+            {
+                memmove(dest,
+                        (*node).alloc_record.mem,
+                        (*node).alloc_record.size);
+                (*node).alloc_record.mem = dest;
+                (*report).bytes_moved += (*node).alloc_record.size;
+                (*report).allocs_moved++;
+            }
+
+            (*node).prev = last_alloc;
+            if(last_alloc != NULL)
+            {
+                (*last_alloc).next = node;
+            }
+            else
+            {
+                (*pool_manager).head_node = node;
+            }
+            last_alloc = node;
+            dest += (*node).alloc_record.size;
+        }
+        node = next_node;
+    }
+
+    if(tail_gap == NULL)
+    {// no gaps, nothing moved
+        return ALLOC_OK;
+    }
+
+    // the gaps are all gone, NEXT_FIT goes on after the allocations
+    _mem_clear_gap_ix(pool_manager);
+    (*pool_manager).rover = dest;
+
+    // one gap from there to the end of the pool
+    (*tail_gap).alloc_record.mem = dest;
+    (*tail_gap).alloc_record.size =
+            (size_t) ((*pool).mem + (*pool).total_size - dest);
+    (*tail_gap).prev = last_alloc;
+    (*tail_gap).next = NULL;
+    if(last_alloc != NULL)
+    {
+        (*last_alloc).next = tail_gap;
+    }
+    else
+    {
+        (*pool_manager).head_node = tail_gap;
+    }
+    (*pool_manager).tail_node = tail_gap;
+
+    return _mem_add_to_gap_ix(pool_manager,
+                              (*tail_gap).alloc_record.size,
+                              tail_gap);
+}//End _mem_pool_compact
+
+// Move allocations down one at a time, until the report shows at least
+// max_bytes moved or max_ns have passed since start. A move is never
+// split, so one large allocation can take the call past max_ns. The
+// steps fill one gap at a time (kept in the pool manager between
+// calls), the largest with something after it, with
+// the last allocation in the pool, the one next to the tail gap, so the
+// tail gap grows and every allocation moves about once. When the last
+// allocation doesn't fit, the gap slides up past the allocation after
+// it instead, swallowing the gaps it meets.
+static alloc_status
+    _mem_pool_compact_step(pool_pt pool,
+                           size_t max_bytes,
+                           unsigned long max_ns,
+                           const struct timespec *start,
+                           pool_compact_pt report)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+
+    if((*pool_manager).pool.policy == BUDDY ||
+       (*pool_manager).pool.policy == FIXED)
+    {// blocks are tied to their place (buddy order, object slot)
+        return ALLOC_FAIL;
+    }
+
+    if((*pool_manager).pool.policy == ARENA)
+    {// ARENA, the allocations are back to back from the start already
+        return ALLOC_OK;
+    }
+
+    // cached blocks are free, they become gaps first (not moved as live)
+    _mem_pool_flush_quick_lists(pool);
+
+    alloc_status status = ALLOC_OK;
+    while(status == ALLOC_OK &&
+          _mem_compact_budget_left(max_bytes, max_ns, start, report))
+    {
+        node_pt gap_node = (*pool_manager).compact_gap;
+        if(gap_node == NULL ||
+           (*gap_node).allocated ||
+           (*gap_node).next == NULL)
+        {// it reached the end (or was allocated), pick another
+            status = _mem_compact_pick(pool_manager, &gap_node);
+            (*pool_manager).compact_gap = gap_node;
+            if(gap_node == NULL)
+            {// no gap has anything after it, the pool is compact
+                break;
+            }
+        }
+
+        node_pt tail_gap = (*pool_manager).tail_node;
+        if(status != ALLOC_OK || (*tail_gap).allocated)
+        {// no tail gap to grow yet, slide until the gap becomes it
+            status = _mem_compact_slide(pool_manager, gap_node, report);
+            continue;
+        }
+
+        node_pt last_node = (*tail_gap).prev;
+        if((*last_node).alloc_record.size <=
+                (*gap_node).alloc_record.size)
+        {// the last allocation fits in the gap
+            status = _mem_compact_fill(pool_manager, gap_node,
+                                       last_node, report);
+        }
+        else
+        {
+            status = _mem_compact_slide(pool_manager, gap_node, report);
+        }
+    }
+
+    return status;
+}//End _mem_pool_compact_step
+
+static int
+    _mem_compact_budget_left(size_t max_bytes,
+                             unsigned long max_ns,
+                             const struct timespec *start,
+                             pool_compact_pt report)
+{
+    // a limit of 0 is no limit
+    return (max_bytes == 0 || (*report).bytes_moved < max_bytes) &&
+           (max_ns == 0 || _mem_elapsed_ns(start) < max_ns);
+}//End _mem_compact_budget_left
+
+static alloc_status
+    _mem_compact_pick(pool_mgr_pt pool_mgr,
+                      node_pt *gap_node)
+{
+    node_pt tail_node = (*pool_mgr).tail_node;
+    if((*tail_node).allocated)
+    {// no tail gap, any gap has something after it
+        *gap_node = _mem_largest_gap(pool_mgr);
+        return ALLOC_OK;
+    }
+
+    // the tail gap has nothing to slide past, leave it out of the search
+    _mem_remove_from_gap_ix(pool_mgr,
+                            (*tail_node).alloc_record.size,
+                            tail_node);
+    *gap_node = _mem_largest_gap(pool_mgr);
+    return _mem_add_to_gap_ix(pool_mgr,
+                              (*tail_node).alloc_record.size,
+                              tail_node);
+}//End _mem_compact_pick
+
+static alloc_status
+    _mem_compact_fill(pool_mgr_pt pool_mgr,
+                      node_pt gap_node,
+                      node_pt alloc_node,
+                      pool_compact_pt report)
+{
+    // both gaps change, they come out of the gap index
+    node_pt tail_gap = (*alloc_node).next;
+    _mem_remove_from_gap_ix(pool_mgr,
+                            (*gap_node).alloc_record.size,
+                            gap_node);
+    _mem_remove_from_gap_ix(pool_mgr,
+                            (*tail_gap).alloc_record.size,
+                            tail_gap);
+
+    // move the allocation to the start of the gap, the tail gap grows
+    // down over its old place
+    char *dest = (*gap_node).alloc_record.mem;
+    memmove(dest,
+            (*alloc_node).alloc_record.mem,
+            (*alloc_node).alloc_record.size);
+    (*tail_gap).alloc_record.mem = (*alloc_node).alloc_record.mem;
+    (*tail_gap).alloc_record.size += (*alloc_node).alloc_record.size;
+    (*alloc_node).alloc_record.mem = dest;
+    (*gap_node).alloc_record.mem += (*alloc_node).alloc_record.size;
+    (*gap_node).alloc_record.size -= (*alloc_node).alloc_record.size;
+    (*report).bytes_moved += (*alloc_node).alloc_record.size;
+    (*report).allocs_moved++;
+
+    // unlink it (the gap is before it, so it has a prev)...
+    (*(*alloc_node).prev).next = tail_gap;
+    (*tail_gap).prev = (*alloc_node).prev;
+
+    // ...and link it in front of the gap
+    (*alloc_node).prev = (*gap_node).prev;
+    if((*gap_node).prev != NULL)
+    {
+        (*(*gap_node).prev).next = alloc_node;
+    }
+    else
+    {
+        (*pool_mgr).head_node = alloc_node;
+    }
+    (*alloc_node).next = gap_node;
+    (*gap_node).prev = alloc_node;
+
+    if((*gap_node).alloc_record.size == 0)
+    {// filled exactly, release the gap node
+        (*alloc_node).next = (*gap_node).next;
+        (*(*gap_node).next).prev = alloc_node;
+        _mem_put_unused_node(pool_mgr, gap_node);
+    }
+    else if(_mem_add_to_gap_ix(pool_mgr,
+                               (*gap_node).alloc_record.size,
+                               gap_node) != ALLOC_OK)
+    {
+        return ALLOC_FAIL;
+    }
+
+    // the tail gap may meet gaps before it now (the gap just filled, too)
+    return _mem_compact_merge_back(pool_mgr, tail_gap);
+}//End _mem_compact_fill
+
+static alloc_status
+    _mem_compact_slide(pool_mgr_pt pool_mgr,
+                       node_pt gap_node,
+                       pool_compact_pt report)
+{
+    // the gap moves, it goes back into the gap index at its new place
+    _mem_remove_from_gap_ix(pool_mgr,
+                            (*gap_node).alloc_record.size,
+                            gap_node);
+
+    node_pt alloc_node = (*gap_node).next;
+    if((*alloc_node).allocated)
+    {// move the allocation down to the start of the gap
+        char *dest = (*gap_node).alloc_record.mem;
+        memmove(dest,
+                (*alloc_node).alloc_record.mem,
+                (*alloc_node).alloc_record.size);
+        (*alloc_node).alloc_record.mem = dest;
+        (*gap_node).alloc_record.mem = dest + (*alloc_node).alloc_record.size;
+        (*report).bytes_moved += (*alloc_node).alloc_record.size;
+        (*report).allocs_moved++;
+
+        // swap the two in the list
+        node_pt prev_node = (*gap_node).prev;
+        node_pt next_node = (*alloc_node).next;
+        (*alloc_node).prev = prev_node;
+        if(prev_node != NULL)
+        {
+            (*prev_node).next = alloc_node;
+        }
+        else
+        {
+            (*pool_mgr).head_node = alloc_node;
+        }
+        (*alloc_node).next = gap_node;
+        (*gap_node).prev = alloc_node;
+        (*gap_node).next = next_node;
+        if(next_node != NULL)
+        {
+            (*next_node).prev = gap_node;
+        }
+        else
+        {
+            (*pool_mgr).tail_node = gap_node;
+        }
+    }
+
+    while((*gap_node).next != NULL && (*(*gap_node).next).allocated == 0)
+    {// swallow the gaps it meets
+        node_pt next_node = (*gap_node).next;
+        _mem_remove_from_gap_ix(pool_mgr,
+                                (*next_node).alloc_record.size,
+                                next_node);
+        (*gap_node).alloc_record.size += (*next_node).alloc_record.size;
+        (*gap_node).next = (*next_node).next;
+        if((*next_node).next != NULL)
+        {
+            (*(*next_node).next).prev = gap_node;
+        }
+        else
+        {
+            (*pool_mgr).tail_node = gap_node;
+        }
+        _mem_put_unused_node(pool_mgr, next_node);
+    }
+
+    return _mem_add_to_gap_ix(pool_mgr,
+                              (*gap_node).alloc_record.size,
+                              gap_node);
+}//End _mem_compact_slide
+
+static alloc_status
+    _mem_compact_merge_back(pool_mgr_pt pool_mgr,
+                            node_pt gap_node)
+{
+    // gap_node is out of the gap index, the earlier gap absorbs it
+    while((*gap_node).prev != NULL && (*(*gap_node).prev).allocated == 0)
+    {
+        node_pt prev_node = (*gap_node).prev;
+        _mem_remove_from_gap_ix(pool_mgr,
+                                (*prev_node).alloc_record.size,
+                                prev_node);
+        (*prev_node).alloc_record.size += (*gap_node).alloc_record.size;
+        (*prev_node).next = (*gap_node).next;
+        if((*gap_node).next != NULL)
+        {
+            (*(*gap_node).next).prev = prev_node;
+        }
+        else
+        {
+            (*pool_mgr).tail_node = prev_node;
+        }
+        _mem_put_unused_node(pool_mgr, gap_node);
+        gap_node = prev_node;
+    }
+
+    return _mem_add_to_gap_ix(pool_mgr,
+                              (*gap_node).alloc_record.size,
+                              gap_node);
+}//End _mem_compact_merge_back
+
+static node_pt _mem_largest_gap(pool_mgr_pt pool_mgr)
+{
+    if((*pool_mgr).pool.num_gaps == 0)
+    {// no gaps
+        return NULL;
+    }
+
+    if((*pool_mgr).pool.policy == TLSF)
+    {// TLSF, the head of the highest non-empty list (largest to a list)
+        tlsf_pt tlsf = (*pool_mgr).tlsf;
+        unsigned fl = _mem_tlsf_msb((size_t) (*tlsf).fl_bitmap);
+        unsigned sl = _mem_tlsf_msb((*tlsf).sl_bitmap[fl]);
+        return _mem_node_at(pool_mgr,
+                            (*pool_mgr).gap_ix[(*tlsf).heads[fl][sl]].node);
+    }
+
+    // follow the subtree maximum down to the gap that has it
+    unsigned slot = (*pool_mgr).gap_ix_root;
+    while(1)
+    {
+        gap_pt gap = &(*pool_mgr).gap_ix[slot];
+        if((*gap).size == (*gap).max_size)
+        {
+            return _mem_node_at(pool_mgr, (*gap).node);
+        }
+        else if((*gap).left != MEM_GAP_IX_NIL &&
+                (*pool_mgr).gap_ix[(*gap).left].max_size == (*gap).max_size)
+        {
+            slot = (*gap).left;
+        }
+        else
+        {
+            slot = (*gap).right;
+        }
+    }
+}//End _mem_largest_gap
+
+static unsigned long _mem_elapsed_ns(const struct timespec *start)
+{
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+
+    long long elapsed = (long long) (now.tv_sec - (*start).tv_sec) *
+                        1000000000LL +
+                        (now.tv_nsec - (*start).tv_nsec);
+
+    // the wall clock may have been set back
+    return (elapsed > 0) ? (unsigned long) elapsed : 0;
+}//End _mem_elapsed_ns
+
+static void _mem_pool_destroy(pool_mgr_pt pool_mgr)
+{
+    // free node heap (NULL for FIXED pools)
+    _mem_free_node_heap(pool_mgr);
+
+    // free gap index
+    free((*pool_mgr).gap_ix);
+    (*pool_mgr).gap_ix = NULL;
+
+    // free segregated free lists (NULL unless TLSF or BUDDY)
+    free((*pool_mgr).tlsf);
+    (*pool_mgr).tlsf = NULL;
+
+    // free quick list heads (NULL unless enabled)
+    free((*pool_mgr).quick_heads);
+    (*pool_mgr).quick_heads = NULL;
+
+    if((*pool_mgr).slab != NULL)
+    {// free slab records and descriptor (FIXED only)
+        free((*(*pool_mgr).slab).records);
+        free((*pool_mgr).slab);
+        (*pool_mgr).slab = NULL;
+    }
+
+    if((*pool_mgr).arena != NULL)
+    {// free arena record chunks and descriptor (ARENA only)
+        for(unsigned chunk = 0; chunk < (*(*pool_mgr).arena).num_chunks;
+            chunk++)
+        {
+            free((*(*pool_mgr).arena).chunks[chunk]);
+        }
+        free((*(*pool_mgr).arena).chunks);
+        free((*pool_mgr).arena);
+        (*pool_mgr).arena = NULL;
+    }
+
+    // free pool lock and mgr
+    _mem_destroy_lock(pool_mgr);
+    free(pool_mgr);
+}//End _mem_pool_destroy
+
+static alloc_pt _mem_new_alloc_shards(pool_mgr_pt pool_mgr, size_t size)
+{
+    unsigned num_shards = _mem_shard_count(pool_mgr);
+    unsigned home = (num_shards > 1) ? _mem_shard_home(num_shards) : 0;
+    alloc_pt alloc = NULL;
+
+    for(unsigned tried = 0; alloc == NULL && tried < num_shards; tried++)
+    {// the thread's own shard first, then the others in turn
+        pool_mgr_pt shard =
+                _mem_shard_at(pool_mgr, (home + tried) % num_shards);
+        _mem_write_begin(shard);
+        alloc = _mem_new_alloc(&(*shard).pool, size);
+        _mem_write_end(shard);
+    }
+
+    return alloc;
+}//End _mem_new_alloc_shards
+
+static alloc_pt _mem_new_alloc(pool_pt pool, size_t size)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+
+    if((*pool_manager).quick_heads != NULL &&
+       size > 0 && size <= (*pool_manager).quick_max)
+    {// reuse a cached block of this exact size, gap index untouched
+        node_pt cached_node = _mem_quick_pop(pool_manager, size);
+        if(cached_node != NULL)
+        {
+            // update metadata (num_allocs, alloc_size)
+            (*pool_manager).pool.num_allocs++;
+            (*pool_manager).pool.alloc_size += size;
+            return (alloc_pt) cached_node;
+        }
+    }
+
+    if((*pool_manager).pool.num_gaps == 0 &&
+       (*pool_manager).quick_blocks == 0)
+    {// check if any gaps (or cached blocks), return null if none
+        return NULL;
+    }
+
+    if((*pool_manager).pool.policy == FIXED)
+    {// FIXED, pop an object off the free list
+        return _mem_slab_alloc(pool_manager, size);
+    }
+
+    if((*pool_manager).pool.policy == ARENA)
+    {// ARENA, bump the offset
+        return _mem_arena_alloc(pool_manager, size);
+    }
+
+    if((*pool_manager).pool.policy == BUDDY)
+    {// BUDDY, split a power-of-two block down to size
+        return (alloc_pt) _mem_buddy_alloc(pool_manager, size);
+    }
+
+    // expand heap node, if necessary, quit on error
+    if(_mem_resize_node_heap(pool_manager) != ALLOC_OK)
+    {
+        return NULL;
+    }
+
+    // get a node for allocation:
+    node_pt alloc_node = _mem_find_gap(pool_manager, size);
+
+    if(alloc_node == NULL && (*pool_manager).quick_blocks != 0)
+    {// the free space may be on the quick lists, merge it back
+        _mem_pool_flush_quick_lists(pool);
+        alloc_node = _mem_find_gap(pool_manager, size);
+    }
+
+    if(alloc_node == NULL)
+    {// check if node found
+        return NULL;
+    }
+
+    // update metadata (num_allocs, alloc_size)
+    (*pool_manager).pool.num_allocs++;
+    (*pool_manager).pool.alloc_size += size;
+
+    // calculate the size of the remaining gap, if any
+    size_t remaining_gap_size = (*alloc_node).alloc_record.size - size;
+
+    // remove node from gap index
+    _mem_remove_from_gap_ix(pool_manager,
+                            (*alloc_node).alloc_record.size,
+                            alloc_node);
+
+    // convert gap_node to an allocation node of given size
+    (*alloc_node).allocated = 1;
+    (*alloc_node).alloc_record.size = size;
+
+    // the next NEXT_FIT search starts right after this allocation
+    (*pool_manager).rover = (*alloc_node).alloc_record.mem + size;
+
+    // adjust node heap:
+    if(remaining_gap_size != 0)
+    {//   if remaining gap, need a new node
+        node_pt unused_node = _mem_get_unused_node(pool_manager);
+
+        if(unused_node == NULL)
+        {//   make sure one was found
+            return NULL;
+        }
+
+        //   initialize it to a gap node
+        (*unused_node).alloc_record.size = remaining_gap_size;
+        (*unused_node).alloc_record.mem =
+                (*alloc_node).alloc_record.mem + size;
+        (*unused_node).allocated = 0;
+
+        //  update linked list (new node right after the node for allocation)
+        (*unused_node).prev = alloc_node;
+        (*unused_node).next = (*alloc_node).next;
+        if((*alloc_node).next != NULL)
+        {
+            (*(*alloc_node).next).prev = unused_node;
+        }
+        else
+        {
+            (*pool_manager).tail_node = unused_node;
+        }
+        (*alloc_node).next = unused_node;
+
+        //   add to gap index
+        _mem_add_to_gap_ix(pool_manager, remaining_gap_size, unused_node);
+    }
+
+    // return allocation record by casting the node to (alloc_pt)
+    return (alloc_pt) alloc_node;
+}//End _mem_new_alloc
+
+// The gap the pool's policy picks for size bytes, NULL if none fits.
+static node_pt _mem_find_gap(pool_mgr_pt pool_mgr, size_t size)
+{
+    if((*pool_mgr).pool.policy == FIRST_FIT)
+    {// FIRST_FIT, the lowest-address sufficient gap in the gap tree
+        return _mem_gap_ix_first_fit(pool_mgr, size);
+    }
+    else if((*pool_mgr).pool.policy == NEXT_FIT)
+    {// NEXT_FIT, the first sufficient gap from the rover on, wrapping
+        return _mem_gap_ix_next_fit(pool_mgr, size);
+    }
+    else if((*pool_mgr).pool.policy == BEST_FIT)
+    {// BEST_FIT, the smallest sufficient gap in the gap tree
+        return _mem_gap_ix_best_fit(pool_mgr, size);
+    }
+    else if((*pool_mgr).pool.policy == TLSF)
+    {// TLSF, a gap from the first non-empty sufficient size class
+        return _mem_tlsf_find(pool_mgr, size);
+    }
+    return NULL;
+}//End _mem_find_gap
+
+static alloc_status
+    _mem_new_alloc_batch(pool_pt pool,
+                         const size_t *sizes,
+                         unsigned num_allocs,
+                         alloc_pt *allocs)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+
+    if(num_allocs == 0)
+    {// nothing to carve
+        return ALLOC_OK;
+    }
+
+    // add up the batch, SIZE_MAX if it overflows (then nothing fits)
+    size_t total_size = 0;
+    for(unsigned ix = 0; ix < num_allocs; ix++)
+    {
+        total_size = (sizes[ix] > SIZE_MAX - total_size) ?
+                     SIZE_MAX : total_size + sizes[ix];
+    }
+
+    // one gap for the whole batch: one search, one gap index removal,
+    // at most one insertion (the remainder), and nodes reserved up front
+    node_pt gap_node = NULL;
+    if((*pool_manager).pool.policy != FIXED &&
+       (*pool_manager).pool.policy != BUDDY &&
+       (*pool_manager).pool.policy != ARENA &&
+       total_size != SIZE_MAX &&
+       (*pool_manager).pool.num_gaps != 0 &&
+       _mem_reserve_nodes(pool_manager, num_allocs) == ALLOC_OK)
+    {
+        gap_node = _mem_find_gap(pool_manager, total_size);
+    }
+
+    if(gap_node == NULL)
+    {// no single gap fits (or FIXED/BUDDY/ARENA), one at a time
+        for(unsigned ix = 0; ix < num_allocs; ix++)
+        {
+            allocs[ix] = _mem_new_alloc(pool, sizes[ix]);
+
+            if(allocs[ix] == NULL)
+            {// all or nothing, give back what the batch got so far
+                while(ix-- > 0)
+                {
+                    _mem_del_alloc(pool, allocs[ix]);
+                    allocs[ix] = NULL;
+                }
+                return ALLOC_FAIL;
+            }
+        }
+        return ALLOC_OK;
+    }
+
+    size_t remaining_gap_size = (*gap_node).alloc_record.size - total_size;
+    node_pt next_node = (*gap_node).next;
+    char *mem = (*gap_node).alloc_record.mem;
+
+    // remove node from gap index
+    _mem_remove_from_gap_ix(pool_manager,
+                            (*gap_node).alloc_record.size,
+                            gap_node);
+
+    // carve the allocations back to back, the gap node is the first
+    node_pt prev_node = (*gap_node).prev;
+    for(unsigned ix = 0; ix < num_allocs; ix++)
+    {
+        node_pt alloc_node = (ix == 0) ?
+                             gap_node : _mem_get_unused_node(pool_manager);
+        (*alloc_node).alloc_record.size = sizes[ix];
+        (*alloc_node).alloc_record.mem = mem;
+        (*alloc_node).allocated = 1;
+        (*alloc_node).prev = prev_node;
+        if(prev_node != NULL)
+        {
+            (*prev_node).next = alloc_node;
+        }
+
+        mem += sizes[ix];
+        prev_node = alloc_node;
+        allocs[ix] = (alloc_pt) alloc_node;
+    }
+
+    node_pt remaining_node = NULL;
+    if(remaining_gap_size != 0)
+    {// if remaining gap, it follows the batch
+        remaining_node = _mem_get_unused_node(pool_manager);
+        (*remaining_node).alloc_record.size = remaining_gap_size;
+        (*remaining_node).alloc_record.mem = mem;
+        (*remaining_node).allocated = 0;
+        (*remaining_node).prev = prev_node;
+        (*prev_node).next = remaining_node;
+        prev_node = remaining_node;
+    }
+
+    // relink the rest of the list
+    (*prev_node).next = next_node;
+    if(next_node != NULL)
+    {
+        (*next_node).prev = prev_node;
+    }
+    else
+    {
+        (*pool_manager).tail_node = prev_node;
+    }
+
+    if(remaining_node != NULL)
+    {// add to gap index
+        _mem_add_to_gap_ix(pool_manager, remaining_gap_size, remaining_node);
+    }
+
+    // update metadata (num_allocs, alloc_size), the rover follows the batch
+    (*pool_manager).pool.num_allocs += num_allocs;
+    (*pool_manager).pool.alloc_size += total_size;
+    (*pool_manager).rover = mem;
+
+    return ALLOC_OK;
+}//End _mem_new_alloc_batch
+
+static alloc_status _mem_del_alloc(pool_pt pool, alloc_pt alloc)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+
+    if((*pool_manager).pool.policy == FIXED)
+    {// FIXED, push the object on the free list (alloc is not a node)
+        return _mem_slab_free(pool_manager, alloc);
+    }
+
+    if((*pool_manager).pool.policy == ARENA)
+    {// ARENA, only the latest allocation comes back (alloc is not a node)
+        return _mem_arena_free(pool_manager, alloc);
+    }
+
+    // get node from alloc by casting the pointer to (node_pt)
+    node_pt node_to_delete = (node_pt) alloc;
+
+    // outstanding handles to this allocation go stale
+    (*node_to_delete).generation++;
+
+    if((*pool_manager).pool.policy == BUDDY)
+    {// BUDDY, merge with free buddies only
+        return _mem_buddy_free(pool_manager, node_to_delete);
+    }
+
+    if((*pool_manager).quick_heads != NULL &&
+       (*alloc).size > 0 && (*alloc).size <= (*pool_manager).quick_max)
+    {// small block, cache it by its exact size instead of merging
+        _mem_quick_push(pool_manager, node_to_delete);
+        return ALLOC_OK;
+    }
+
+    // update metadata (num_allocs, alloc_size)
+    (*pool_manager).pool.num_allocs--;
+    (*pool_manager).pool.alloc_size -= (*alloc).size;
+
+    // turn it into a gap, merging with any neighbouring gaps
+    return _mem_merge_gap(pool_manager, node_to_delete);
+}//End _mem_del_alloc
+
+// Free a batch sorted by address. Runs of neighbouring allocations and
+// gaps are merged in one pass, and each resulting gap goes into the gap
+// index once, instead of once per free as in _mem_merge_gap().
+static alloc_status
+    _mem_del_alloc_batch(pool_pt pool,
+                         alloc_pt *allocs,
+                         unsigned num_allocs)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+    alloc_status status = ALLOC_OK;
+
+    if((*pool_manager).pool.policy == FIXED ||
+       (*pool_manager).pool.policy == BUDDY ||
+       (*pool_manager).pool.policy == ARENA)
+    {// no gaps to merge or merged by order, one at a time, last first
+        unsigned ix = num_allocs;
+        while(ix-- > 0)
+        {
+            if(_mem_del_alloc(pool, allocs[ix]) != ALLOC_OK)
+            {
+                status = ALLOC_FAIL;
+            }
+        }
+        return status;
+    }
+
+    // retire the allocations; small ones go on the quick lists as usual,
+    // the rest stay in allocs (still in address order) to be merged
+    unsigned num_merge = 0;
+    for(unsigned ix = 0; ix < num_allocs; ix++)
+    {
+        node_pt node = (node_pt) allocs[ix];
+
+        // outstanding handles to this allocation go stale
+        (*node).generation++;
+
+        if((*pool_manager).quick_heads != NULL &&
+           (*node).alloc_record.size > 0 &&
+           (*node).alloc_record.size <= (*pool_manager).quick_max)
+        {// small block, cache it by its exact size instead of merging
+            _mem_quick_push(pool_manager, node);
+            continue;
+        }
+
+        // update metadata (num_allocs, alloc_size)
+        (*pool_manager).pool.num_allocs--;
+        (*pool_manager).pool.alloc_size -= (*node).alloc_record.size;
+        allocs[num_merge++] = allocs[ix];
+    }
+
+    unsigned ix = 0;
+    while(ix < num_merge)
+    {// each run starts at the lowest freed node not merged yet
+        node_pt gap_node = (node_pt) allocs[ix++];
+        (*gap_node).allocated = 0;
+
+        if((*gap_node).prev != NULL && (*(*gap_node).prev).allocated == 0)
+        {// a gap before the run (not a freed node), merge into it
+            node_pt prev_node = (*gap_node).prev;
+            _mem_remove_from_gap_ix(pool_manager,
+                                    (*prev_node).alloc_record.size,
+                                    prev_node);
+            (*prev_node).alloc_record.size += (*gap_node).alloc_record.size;
+            (*prev_node).next = (*gap_node).next;
+            if((*gap_node).next != NULL)
+            {
+                (*(*gap_node).next).prev = prev_node;
+            }
+            else
+            {
+                (*pool_manager).tail_node = prev_node;
+            }
+            _mem_put_unused_node(pool_manager, gap_node);
+            gap_node = prev_node;
+        }
+
+        while((*gap_node).next != NULL)
+        {// swallow the following freed nodes and gaps
+            node_pt next_node = (*gap_node).next;
+
+            if(ix < num_merge && next_node == (node_pt) allocs[ix])
+            {// the next freed node
+                ix++;
+            }
+            else if((*next_node).allocated == 0)
+            {// a gap, out of the gap index
+                _mem_remove_from_gap_ix(pool_manager,
+                                        (*next_node).alloc_record.size,
+                                        next_node);
+            }
+            else
+            {// an allocation (or cached block) ends the run
+                break;
+            }
+
+            (*gap_node).alloc_record.size += (*next_node).alloc_record.size;
+            (*gap_node).next = (*next_node).next;
+            if((*next_node).next != NULL)
+            {
+                (*(*next_node).next).prev = gap_node;
+            }
+            else
+            {
+                (*pool_manager).tail_node = gap_node;
+            }
+            _mem_put_unused_node(pool_manager, next_node);
+        }
+
+        // the run is one gap now, add it to the gap index once
+        if(_mem_add_to_gap_ix(pool_manager,
+                              (*gap_node).alloc_record.size,
+                              gap_node) != ALLOC_OK)
+        {
+            status = ALLOC_FAIL;
+        }
+    }
+
+    return status;
+}//End _mem_del_alloc_batch
+
+// Sort allocations by address: insertion sort for short batches, an LSD
+// radix sort on the offset into base (one pass per byte of span) for
+// long ones. Falls back to insertion sort if there is no scratch array.
+static void
+    _mem_sort_allocs(alloc_pt *allocs,
+                     unsigned num_allocs,
+                     char *base,
+                     size_t span)
+{
+    alloc_pt *scratch = NULL;
+    if(num_allocs >= MEM_BATCH_RADIX_MIN)
+    {
+        scratch = (alloc_pt*) malloc(num_allocs * sizeof(alloc_pt));
+    }
+
+    if(scratch == NULL)
+    {// insertion sort
+        for(unsigned ix = 1; ix < num_allocs; ix++)
+        {
+            alloc_pt alloc = allocs[ix];
+            unsigned jx = ix;
+            while(jx > 0 && (*allocs[jx - 1]).mem > (*alloc).mem)
+            {
+                allocs[jx] = allocs[jx - 1];
+                jx--;
+            }
+            allocs[jx] = alloc;
+        }
+        return;
+    }
+
+    alloc_pt *from = allocs;
+    alloc_pt *to = scratch;
+    for(unsigned shift = 0;
+        shift < 8 * sizeof(size_t) && ((span - 1) >> shift) != 0;
+        shift += 8)
+    {// one stable counting pass per 8-bit digit, lowest first
+        size_t counts[MEM_RADIX_BUCKETS] = {0};
+        for(unsigned ix = 0; ix < num_allocs; ix++)
+        {
+            counts[((size_t) ((*from[ix]).mem - base) >> shift) & 0xff]++;
+        }
+
+        size_t offset = 0;
+        for(unsigned bucket = 0; bucket < MEM_RADIX_BUCKETS; bucket++)
+        {// bucket counts to bucket starts
+            size_t count = counts[bucket];
+            counts[bucket] = offset;
+            offset += count;
+        }
+
+        for(unsigned ix = 0; ix < num_allocs; ix++)
+        {
+            to[counts[((size_t) ((*from[ix]).mem - base) >> shift) & 0xff]++] =
+                    from[ix];
+        }
+
+        alloc_pt *swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if(from != allocs)
+    {// an odd number of passes leaves the result in scratch
+        memcpy(allocs, from, num_allocs * sizeof(alloc_pt));
+    }
+    free(scratch);
+}//End _mem_sort_allocs
+
+static mem_alloc_handle_t _mem_new_handle(pool_pt pool, size_t size)
+{
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+
+    if((*pool_manager).pool.policy == FIXED ||
+       (*pool_manager).pool.policy == ARENA ||
+       (*pool_manager).shards != NULL)
+    {// FIXED/ARENA pools have no node heap, sharded pools one per shard
+        return 0;
+    }
+
+    node_pt node = (node_pt) _mem_new_alloc(pool, size);
+
+    if(node == NULL)
+    {// check success
+        return 0;
+    }
+
+    if((*node).index >= MEM_HANDLE_INDEX_MASK)
+    {// the node index does not fit, give the allocation back
+        _mem_del_alloc(pool, (alloc_pt) node);
+        return 0;
+    }
+
+    return ((uint32_t) (*node).generation << MEM_HANDLE_INDEX_BITS) |
+           ((*node).index + 1);
+}//End _mem_new_handle
+
+static alloc_status _mem_del_handle(pool_pt pool, mem_alloc_handle_t handle)
+{
+    node_pt node = _mem_handle_node((pool_mgr_pt) pool, handle);
+
+    if(node == NULL)
+    {// stale or foreign handle, nothing to delete
+        return ALLOC_FAIL;
+    }
+
+    return _mem_del_alloc(pool, (alloc_pt) node);
+}//End _mem_del_handle
+
+static void _mem_inspect_pool(pool_pt pool,
+                              pool_segment_pt *segments,
+                              unsigned *num_segments)
+{
+    // get the mgr from the pool
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+
+    if((*pool_manager).pool.policy == FIXED)
+    {// FIXED pools have no node list, walk the records instead
+        _mem_slab_inspect(pool_manager, segments, num_segments);
+        return;
+    }
+
+    if((*pool_manager).pool.policy == ARENA)
+    {// ARENA pools neither, their records are in address order
+        _mem_arena_inspect(pool_manager, segments, num_segments);
+        return;
+    }
+
+    // allocate the segments array with size == used_nodes
+    pool_segment_pt segs = (pool_segment_pt)
+            calloc((*pool_manager).used_nodes, sizeof(pool_segment_t));
+
+    if(segs == NULL)
+    {// check successful
+        return;
+    }
+
+    // the head node is never merged away
+    node_pt current_node = (*pool_manager).head_node;
+    int index = 0;
+    while(current_node != NULL)
+    {//   loop through the node heap and the segments array
+        //for each node, write the size and allocated in the segment
+        segs[index].size = (*current_node).alloc_record.size;
+        segs[index].allocated = (*current_node).cached ?
+                                2 : (*current_node).allocated;
+        index++;
+        current_node = (*current_node).next;
+    }
+
+    // "return" the values:
+    *segments = segs;
+    *num_segments = (*pool_manager).used_nodes;
+
+}//End _mem_inspect_pool
+
+static alloc_status _mem_pool_set_quick_lists(pool_pt pool, size_t max_size)
+{
+    // get the mgr from the pool
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+
+    if((*pool_manager).pool.policy == BUDDY ||
+       (*pool_manager).pool.policy == FIXED ||
+       (*pool_manager).pool.policy == ARENA ||
+       max_size > MEM_QUICK_MAX_SIZE)
+    {// BUDDY blocks must merge by order, FIXED/ARENA have no gap nodes
+        return ALLOC_FAIL;
+    }
+
+    // cached blocks go back to the gap index before the lists change
+    _mem_pool_flush_quick_lists(pool);
+    free((*pool_manager).quick_heads);
+    (*pool_manager).quick_heads = NULL;
+    (*pool_manager).quick_max = 0;
+
+    if(max_size == 0)
+    {// quick lists off
+        return ALLOC_OK;
+    }
+
+    // one list head per exact size 1..max_size
+    (*pool_manager).quick_heads = (unsigned*)
+            malloc(max_size * sizeof(unsigned));
+
+    if((*pool_manager).quick_heads == NULL)
+    {// check success
+        return ALLOC_FAIL;
+    }
+
+    for(size_t size = 0; size < max_size; size++)
+    {
+        (*pool_manager).quick_heads[size] = MEM_GAP_IX_NIL;
+    }
+    (*pool_manager).quick_max = max_size;
+
+    return ALLOC_OK;
+}//End _mem_pool_set_quick_lists
+
+static alloc_status _mem_pool_flush_quick_lists(pool_pt pool)
+{
+    // get the mgr from the pool
+    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+
+    if((*pool_manager).quick_heads == NULL)
+    {// nothing cached
+        return ALLOC_OK;
+    }
+
+    for(size_t size = 1; size <= (*pool_manager).quick_max; size++)
+    {// turn every cached block into a gap, merging as mem_del_alloc would
+        node_pt node;
+        while((node = _mem_quick_pop(pool_manager, size)) != NULL)
+        {
+            if(_mem_merge_gap(pool_manager, node) != ALLOC_OK)
+            {
+                return ALLOC_FAIL;
+            }
+        }
+    }
+    return ALLOC_OK;
+}//End _mem_pool_flush_quick_lists
+
+static unsigned _mem_shard_count(pool_mgr_pt pool_mgr)
+{
+    return ((*pool_mgr).shards != NULL) ? (*pool_mgr).num_shards : 1;
+}//End _mem_shard_count
+
+static pool_mgr_pt _mem_shard_at(pool_mgr_pt pool_mgr, unsigned shard)
+{
+    return ((*pool_mgr).shards != NULL) ? (*pool_mgr).shards[shard] : pool_mgr;
+}//End _mem_shard_at
+
+// The shard an allocation came from, found from its address.
+static pool_mgr_pt _mem_shard_of(pool_mgr_pt pool_mgr, alloc_pt alloc)
+{
+    if((*pool_mgr).shards == NULL)
+    {// a plain pool is its only shard
+        return pool_mgr;
+    }
+
+    size_t shard = (size_t) ((*alloc).mem - (*pool_mgr).pool.mem) /
+                   (*pool_mgr).shard_size;
+
+    // the last shard also holds the remainder of the division
+    return (*pool_mgr).shards[(shard < (*pool_mgr).num_shards) ?
+                              shard : (*pool_mgr).num_shards - 1];
+}//End _mem_shard_of
+
+// The calling thread's home shard. Threads are handed out in turn, so
+// the first num_shards threads to allocate never share a shard.
+static unsigned _mem_shard_home(unsigned num_shards)
+{
+#ifdef MEM_POOL_THREAD_SAFE
+    if(thread_shard == 0)
+    {// first sharded allocation on this thread
+        thread_shard = atomic_fetch_add_explicit(&shard_threads, 1,
+                                                 memory_order_relaxed) + 1;
+    }
+    return (thread_shard - 1) % num_shards;
+#else
+    (void) num_shards;
+    return 0;
+#endif
+}//End _mem_shard_home
+
+static void
+    _mem_shards_inspect(pool_mgr_pt pool_mgr,
+                        pool_segment_pt *segments,
+                        unsigned *num_segments)
+{
+    pool_segment_pt segs = NULL;
+    unsigned num_segs = 0;
+    size_t alloc_size = 0;
+    unsigned num_allocs = 0;
+    unsigned num_gaps = 0;
+
+    for(unsigned ix = 0; ix < (*pool_mgr).num_shards; ix++)
+    {// shards are in address order, so their segments simply follow
+        pool_mgr_pt shard = (*pool_mgr).shards[ix];
+        pool_segment_pt part = NULL;
+        unsigned num_part = 0;
+
+        _mem_lock(shard);
+        _mem_inspect_pool(&(*shard).pool, &part, &num_part);
+        alloc_size += (*shard).pool.alloc_size;
+        num_allocs += (*shard).pool.num_allocs;
+        num_gaps += (*shard).pool.num_gaps;
+        _mem_unlock(shard);
+
+        pool_segment_pt grown = (part == NULL) ? NULL : (pool_segment_pt)
+                realloc(segs, (num_segs + num_part) * sizeof(pool_segment_t));
+
+        if(grown == NULL)
+        {// check success
+            free(part);
+            free(segs);
+            return;
+        }
+
+        memcpy(grown + num_segs, part, num_part * sizeof(pool_segment_t));
+        free(part);
+        segs = grown;
+        num_segs += num_part;
+    }
+
+    // bring the pool's counters up to date with the shards
+    _mem_lock(pool_mgr);
+    (*pool_mgr).pool.alloc_size = alloc_size;
+    (*pool_mgr).pool.num_allocs = num_allocs;
+    (*pool_mgr).pool.num_gaps = num_gaps;
+    _mem_unlock(pool_mgr);
+
+    // "return" the values:
+    *segments = segs;
+    *num_segments = num_segs;
+}//End _mem_shards_inspect
+
+// Copy pool_t. In thread-safe builds this is a seqlock read, without
+// the pool lock: retry if a writer ran during the copy.
+static void _mem_read_pool(pool_mgr_pt pool_mgr, pool_pt copy)
+{
+#ifdef MEM_POOL_THREAD_SAFE
+    // mem, policy and total_size never change after the pool is opened
+    (*copy).mem = (*pool_mgr).pool.mem;
+    (*copy).policy = (*pool_mgr).pool.policy;
+    (*copy).total_size = (*pool_mgr).pool.total_size;
+
+    // the counters come from the copies writers publish, not pool_t
+    unsigned seq;
+    do
+    {
+        seq = atomic_load_explicit(&(*pool_mgr).seq,
+                                   memory_order_acquire);
+        (*copy).alloc_size =
+                atomic_load_explicit(&(*pool_mgr).snap_alloc_size,
+                                     memory_order_relaxed);
+        (*copy).num_allocs =
+                atomic_load_explicit(&(*pool_mgr).snap_num_allocs,
+                                     memory_order_relaxed);
+        (*copy).num_gaps =
+                atomic_load_explicit(&(*pool_mgr).snap_num_gaps,
+                                     memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while((seq & 1) ||
+            seq != atomic_load_explicit(&(*pool_mgr).seq,
+                                        memory_order_relaxed));
+#else
+    *copy = (*pool_mgr).pool;
+#endif
+}//End _mem_read_pool
+
+static void _mem_store_lock(mem_ctx_pt ctx)
+{
+#ifdef MEM_POOL_THREAD_SAFE
+    if(ctx == &default_ctx)
+    {// created contexts init their lock in mem_ctx_create
+        pthread_once(&default_ctx_once, _mem_default_ctx_init);
+    }
+    pthread_mutex_lock(&(*ctx).store_lock);
+#else
+    (void) ctx;
+#endif
+}//End _mem_store_lock
+
+static void _mem_store_unlock(mem_ctx_pt ctx)
+{
+#ifdef MEM_POOL_THREAD_SAFE
+    pthread_mutex_unlock(&(*ctx).store_lock);
+#else
+    (void) ctx;
+#endif
+}//End _mem_store_unlock
+
+#ifdef MEM_POOL_THREAD_SAFE
+static void _mem_default_ctx_init(void)
+{
+    pthread_mutex_init(&default_ctx.store_lock, NULL);
+}//End _mem_default_ctx_init
+
+// The thread cache for a pool: the calling thread's slot for it, or a
+// free slot claimed for it if create is set. NULL if there is neither.
+static tcache_pt _mem_tcache_get(pool_mgr_pt pool_mgr, int create)
+{
+    tcache_pt caches = thread_caches;
+
+    if(caches == NULL)
+    {// first block this thread caches, set up its slots
+        if(!create)
+        {
+            return NULL;
+        }
+
+        pthread_once(&tcache_key_once, _mem_tcache_key_init);
+        caches = (tcache_pt) calloc(MEM_TCACHE_POOLS, sizeof(tcache_t));
+
+        if(caches == NULL)
+        {// check success
+            return NULL;
+        }
+        if(pthread_setspecific(tcache_key, caches) != 0)
+        {// no way to flush at thread exit, don't cache
+            free(caches);
+            return NULL;
+        }
+        thread_caches = caches;
+    }
+
+    tcache_pt unused = NULL;
+    for(unsigned slot = 0; slot < MEM_TCACHE_POOLS; slot++)
+    {
+        if(caches[slot].pool_mgr == pool_mgr)
+        {
+            return &caches[slot];
+        }
+        if(caches[slot].pool_mgr == NULL && unused == NULL)
+        {
+            unused = &caches[slot];
+        }
+    }
+
+    if(!create || unused == NULL)
+    {// no slot, more pools in use than the thread caches
+        return NULL;
+    }
+
+    (*unused).pool_mgr = pool_mgr;
+    return unused;
+}//End _mem_tcache_get
+
+static alloc_pt _mem_tcache_pop(pool_mgr_pt pool_mgr, size_t size)
+{
+    if(pool_mgr == NULL || size == 0 ||
+       size > MEM_TCACHE_BINS * MEM_TCACHE_BIN_STEP ||
+       !atomic_load_explicit(&(*pool_mgr).tcache_on, memory_order_relaxed))
+    {// not a size (or pool) this thread caches
+        return NULL;
+    }
+
+    tcache_pt tcache = _mem_tcache_get(pool_mgr, 0);
+
+    if(tcache == NULL)
+    {// nothing cached for this pool
+        return NULL;
+    }
+
+    tcache_bin_pt bin = &(*tcache).bins[(size - 1) / MEM_TCACHE_BIN_STEP];
+    for(unsigned ix = (*bin).count; ix-- > 0; )
+    {// exact size only, most recently freed first
+        alloc_pt alloc = (*bin).blocks[ix];
+        if((*alloc).size == size)
+        {
+            (*bin).count--;
+            memmove(&(*bin).blocks[ix], &(*bin).blocks[ix + 1],
+                    ((*bin).count - ix) * sizeof(alloc_pt));
+            return alloc;
+        }
+    }
+
+    return NULL;
+}//End _mem_tcache_pop
+
+static alloc_status _mem_tcache_push(pool_mgr_pt pool_mgr, alloc_pt alloc)
+{
+    if(pool_mgr == NULL || alloc == NULL || (*alloc).size == 0 ||
+       (*alloc).size > MEM_TCACHE_BINS * MEM_TCACHE_BIN_STEP ||
+       !atomic_load_explicit(&(*pool_mgr).tcache_on, memory_order_relaxed))
+    {// not a size (or pool) this thread caches
+        return ALLOC_FAIL;
+    }
+
+    tcache_pt tcache = _mem_tcache_get(pool_mgr, 1);
+
+    if(tcache == NULL)
+    {// no slot for this pool, free it under the lock
+        return ALLOC_FAIL;
+    }
+
+    tcache_bin_pt bin =
+            &(*tcache).bins[((*alloc).size - 1) / MEM_TCACHE_BIN_STEP];
+    if((*bin).count == MEM_TCACHE_BIN_BLOCKS)
+    {// high-water mark, the older half goes back to the pool
+        _mem_tcache_drain(pool_mgr, bin, MEM_TCACHE_BIN_BLOCKS / 2);
+    }
+
+    // outstanding handles to this allocation go stale
+    node_pt node = (node_pt) alloc;
+    (*node).generation++;
+    (*bin).blocks[(*bin).count++] = alloc;
+
+    return ALLOC_OK;
+}//End _mem_tcache_push
+
+// Give all but the newest keep blocks of a bin back to the pool, as one
+// batch under one lock (per shard).
+static void
+    _mem_tcache_drain(pool_mgr_pt pool_mgr,
+                      tcache_bin_pt bin,
+                      unsigned keep)
+{
+    unsigned batch = (*bin).count - keep;
+    pool_mgr_pt locked = NULL;
+
+    for(unsigned ix = 0; ix < batch; ix++)
+    {// relock only when the batch moves on to another shard
+        pool_mgr_pt shard = _mem_shard_of(pool_mgr, (*bin).blocks[ix]);
+        if(shard != locked)
+        {
+            if(locked != NULL)
+            {
+                _mem_write_end(locked);
+            }
+            _mem_write_begin(shard);
+            locked = shard;
+        }
+        _mem_del_alloc(&(*shard).pool, (*bin).blocks[ix]);
+    }
+    if(locked != NULL)
+    {
+        _mem_write_end(locked);
+    }
+
+    memmove(&(*bin).blocks[0], &(*bin).blocks[batch],
+            keep * sizeof(alloc_pt));
+    (*bin).count = keep;
+}//End _mem_tcache_drain
+
+// Give every block in the cache back to its pool and free the slot.
+static void _mem_tcache_flush(tcache_pt tcache)
+{
+    if(tcache == NULL)
+    {// nothing cached
+        return;
+    }
+
+    for(unsigned bin = 0; bin < MEM_TCACHE_BINS; bin++)
+    {
+        if((*tcache).bins[bin].count > 0)
+        {
+            _mem_tcache_drain((*tcache).pool_mgr, &(*tcache).bins[bin], 0);
+        }
+    }
+    (*tcache).pool_mgr = NULL;
+}//End _mem_tcache_flush
+
+static void _mem_tcache_key_init(void)
+{
+    pthread_key_create(&tcache_key, _mem_tcache_exit);
+}//End _mem_tcache_key_init
+
+// Thread exit: the thread's cached blocks go back to their pools.
+static void _mem_tcache_exit(void *caches)
+{
+    for(unsigned slot = 0; slot < MEM_TCACHE_POOLS; slot++)
+    {
+        _mem_tcache_flush(&((tcache_pt) caches)[slot]);
+    }
+    free(caches);
+    thread_caches = NULL;
+}//End _mem_tcache_exit
+
+// A free off the owner thread: push the node on the pool's remote queue
+// with a CAS instead of taking the lock. The drain takes the whole queue
+// at once, so a node can't be popped and pushed again under a push (ABA).
+static alloc_status _mem_remote_push(pool_mgr_pt pool_mgr, alloc_pt alloc)
+{
+    if(pool_mgr == NULL || alloc == NULL ||
+       !atomic_load_explicit(&(*pool_mgr).remote_on, memory_order_acquire) ||
+       pthread_equal((*pool_mgr).owner, pthread_self()))
+    {// remote frees off, or this is the owner
+        return ALLOC_FAIL;
+    }
+
+    node_pt node = (node_pt) alloc;
+    unsigned head = atomic_load_explicit(&(*pool_mgr).remote_head,
+                                         memory_order_relaxed);
+    do
+    {// the node is still an allocation, its gap_slot is free for the link
+        (*node).gap_slot = head;
+    } while(!atomic_compare_exchange_weak_explicit(&(*pool_mgr).remote_head,
+                                                   &head, (*node).index,
+                                                   memory_order_release,
+                                                   memory_order_relaxed));
+
+    return ALLOC_OK;
+}//End _mem_remote_push
+
+// Free every queued node, in one batch. Called with the pool lock held.
+static void _mem_remote_drain(pool_mgr_pt pool_mgr)
+{
+    if(atomic_load_explicit(&(*pool_mgr).remote_head,
+                            memory_order_relaxed) == MEM_GAP_IX_NIL)
+    {// nothing queued
+        return;
+    }
+
+    unsigned index = atomic_exchange_explicit(&(*pool_mgr).remote_head,
+                                              MEM_GAP_IX_NIL,
+                                              memory_order_acquire);
+    while(index != MEM_GAP_IX_NIL)
+    {// read the link first, a quick list push reuses gap_slot
+        node_pt node = _mem_node_at(pool_mgr, index);
+        index = (*node).gap_slot;
+        _mem_del_alloc(&(*pool_mgr).pool, &(*node).alloc_record);
+        (*pool_mgr).remote_frees++;
+    }
+}//End _mem_remote_drain
+#endif
+
+static void _mem_init_lock(pool_mgr_pt pool_mgr)
+{
+#ifdef MEM_POOL_THREAD_SAFE
+    pthread_mutex_init(&(*pool_mgr).lock, NULL);
+    atomic_init(&(*pool_mgr).seq, 0);
+    atomic_init(&(*pool_mgr).snap_alloc_size, (*pool_mgr).pool.alloc_size);
+    atomic_init(&(*pool_mgr).snap_num_allocs, (*pool_mgr).pool.num_allocs);
+    atomic_init(&(*pool_mgr).snap_num_gaps, (*pool_mgr).pool.num_gaps);
+    atomic_init(&(*pool_mgr).tcache_on, 0);
+    atomic_init(&(*pool_mgr).remote_on, 0);
+    atomic_init(&(*pool_mgr).remote_head, MEM_GAP_IX_NIL);
+#else
+    (void) pool_mgr;
+#endif
+}//End _mem_init_lock
+
+static void _mem_destroy_lock(pool_mgr_pt pool_mgr)
+{
+#ifdef MEM_POOL_THREAD_SAFE
+    pthread_mutex_destroy(&(*pool_mgr).lock);
+#else
+    (void) pool_mgr;
+#endif
+}//End _mem_destroy_lock
+
+static void _mem_lock(pool_mgr_pt pool_mgr)
+{
+#ifdef MEM_POOL_THREAD_SAFE
+    pthread_mutex_lock(&(*pool_mgr).lock);
+#else
+    (void) pool_mgr;
+#endif
+}//End _mem_lock
+
+static void _mem_unlock(pool_mgr_pt pool_mgr)
+{
+#ifdef MEM_POOL_THREAD_SAFE
+    pthread_mutex_unlock(&(*pool_mgr).lock);
+#else
+    (void) pool_mgr;
+#endif
+}//End _mem_unlock
+
+// Writers bump seq to odd before touching the pool and back to even
+// after, publishing the pool_t counters in between, so
+// mem_pool_snapshot can read them without the lock.
+static void _mem_write_begin(pool_mgr_pt pool_mgr)
+{
+#ifdef MEM_POOL_THREAD_SAFE
+    pthread_mutex_lock(&(*pool_mgr).lock);
+    unsigned seq = atomic_load_explicit(&(*pool_mgr).seq,
+                                        memory_order_relaxed);
+    atomic_store_explicit(&(*pool_mgr).seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    // whoever takes the lock first frees what other threads queued
+    _mem_remote_drain(pool_mgr);
+#else
+    (void) pool_mgr;
+#endif
+}//End _mem_write_begin
+
+static void _mem_write_end(pool_mgr_pt pool_mgr)
+{
+#ifdef MEM_POOL_THREAD_SAFE
+    atomic_store_explicit(&(*pool_mgr).snap_alloc_size,
+                          (*pool_mgr).pool.alloc_size, memory_order_relaxed);
+    atomic_store_explicit(&(*pool_mgr).snap_num_allocs,
+                          (*pool_mgr).pool.num_allocs, memory_order_relaxed);
+    atomic_store_explicit(&(*pool_mgr).snap_num_gaps,
+                          (*pool_mgr).pool.num_gaps, memory_order_relaxed);
+
+    unsigned seq = atomic_load_explicit(&(*pool_mgr).seq,
+                                        memory_order_relaxed);
+    atomic_store_explicit(&(*pool_mgr).seq, seq + 1, memory_order_release);
+    pthread_mutex_unlock(&(*pool_mgr).lock);
+#else
+    (void) pool_mgr;
+#endif
+}//End _mem_write_end
+
+// Whether threads may hold blocks of the pool in their caches. The flag
+// lives on the pool the caller opened, a sharded pool's shards have none.
+static int _mem_tcache_on(pool_mgr_pt pool_mgr)
+{
+#ifdef MEM_POOL_THREAD_SAFE
+    return atomic_load_explicit(&(*pool_mgr).tcache_on,
+                                memory_order_relaxed) != 0;
+#else
+    (void) pool_mgr;
+    return 0;
+#endif
+}//End _mem_tcache_on
+
+static alloc_status _mem_resize_pool_store(mem_ctx_pt ctx)
+{
+    float size_used_percent = (float)
+        (*ctx).pool_store_size / (*ctx).pool_store_capacity;
+    unsigned new_cap = (*ctx).pool_store_capacity;
+
+    if (size_used_percent > MEM_POOL_STORE_FILL_FACTOR)
+    {//pool_store is getting full and needs to expand
+        new_cap = MEM_POOL_STORE_EXPAND_FACTOR * (*ctx).pool_store_capacity;
+    }
+    else if (size_used_percent < MEM_POOL_STORE_SHRINK_FACTOR &&
+             (*ctx).pool_store_capacity > MEM_POOL_STORE_INIT_CAPACITY)
+    {//most pools have been closed, give memory back
+        new_cap = (*ctx).pool_store_capacity / MEM_POOL_STORE_EXPAND_FACTOR;
+        if (new_cap < MEM_POOL_STORE_INIT_CAPACITY)
+        {
+            new_cap = MEM_POOL_STORE_INIT_CAPACITY;
+        }
+    }
+
+    if (new_cap == (*ctx).pool_store_capacity)
+    {// nothing to do
+        return ALLOC_OK;
+    }
+
+    pool_mgr_pt *pool_store = (pool_mgr_pt*)
+            realloc((*ctx).pool_store, new_cap * sizeof(pool_mgr_pt));
+
+    if (pool_store == NULL)
+    {// failing to shrink is harmless, failing to grow is not
+        return (new_cap > (*ctx).pool_store_capacity) ?
+               ALLOC_FAIL : ALLOC_OK;
+    }
+
+    (*ctx).pool_store = pool_store;
+    (*ctx).pool_store_capacity = new_cap;
+    return ALLOC_OK;
+}//End _mem_resize_pool_store
+
+static void _mem_store_add(mem_ctx_pt ctx, pool_mgr_pt pool_mgr)
+{
+    (*pool_mgr).ctx = ctx;
+    (*pool_mgr).store_slot = (*ctx).pool_store_size;
+    (*ctx).pool_store[(*ctx).pool_store_size] = pool_mgr;
+    (*ctx).pool_store_size++;
+}//End _mem_store_add
+
+// The store is kept dense: the last pool moves into the closed pool's
+// slot, so closing is O(1) and slots are always reused.
+static void _mem_store_remove(pool_mgr_pt pool_mgr)
+{
+    mem_ctx_pt ctx = (*pool_mgr).ctx;
+    unsigned slot = (*pool_mgr).store_slot;
+
+    (*ctx).pool_store_size--;
+    pool_mgr_pt last = (*ctx).pool_store[(*ctx).pool_store_size];
+    (*ctx).pool_store[slot] = last;
+    (*last).store_slot = slot;
+    (*ctx).pool_store[(*ctx).pool_store_size] = NULL;
+
+    // shrink the pool store, if mostly empty
+    _mem_resize_pool_store(ctx);
+}//End _mem_store_remove
+
+static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr)
+{
+    if ((*pool_mgr).used_nodes == (*pool_mgr).total_nodes)
+    {//node_heap is full and needs another chunk
+        return _mem_expand_node_heap(pool_mgr);
+    }
+    return ALLOC_OK;
+}//End _mem_resize_node_heap
+
+// Make sure num_nodes more nodes can be taken without expanding.
+static alloc_status
+    _mem_reserve_nodes(pool_mgr_pt pool_mgr,
+                       unsigned num_nodes)
+{
+    while((*pool_mgr).total_nodes - (*pool_mgr).used_nodes < num_nodes)
+    {// add chunks until they fit
+        if(_mem_expand_node_heap(pool_mgr) != ALLOC_OK)
+        {
+            return ALLOC_FAIL;
+        }
+    }
+    return ALLOC_OK;
+}//End _mem_reserve_nodes
+
+static alloc_status _mem_expand_node_heap(pool_mgr_pt pool_mgr)
+{
+    unsigned num_chunks =
+            (*pool_mgr).total_nodes / MEM_NODE_HEAP_CHUNK_NODES;
+
+    if(num_chunks == (*pool_mgr).node_heap_capacity)
+    {// only the chunk pointers move, the nodes stay where they are
+        unsigned new_cap =
+                MEM_NODE_HEAP_EXPAND_FACTOR * (*pool_mgr).node_heap_capacity;
+        node_pt *new_heap = (node_pt*)
+                realloc((*pool_mgr).node_heap, new_cap * sizeof(node_pt));
+
+        if(new_heap == NULL)
+        {// check success, the old heap is still intact
+            return ALLOC_FAIL;
+        }
+        (*pool_mgr).node_heap = new_heap;
+        (*pool_mgr).node_heap_capacity = new_cap;
+    }
+
+    // new chunk, zeroed so that its nodes read as unused
+    node_pt chunk = (node_pt)
+            calloc(MEM_NODE_HEAP_CHUNK_NODES, sizeof(node_t));
+
+    if(chunk == NULL)
+    {// check success
+        return ALLOC_FAIL;
+    }
+
+    (*pool_mgr).node_heap[num_chunks] = chunk;
+    (*pool_mgr).total_nodes += MEM_NODE_HEAP_CHUNK_NODES;
+    return ALLOC_OK;
+}//End _mem_expand_node_heap
+
+static void _mem_free_node_heap(pool_mgr_pt pool_mgr)
+{
+    if((*pool_mgr).node_heap == NULL)
+    {
+        return;
+    }
+
+    unsigned num_chunks =
+            (*pool_mgr).total_nodes / MEM_NODE_HEAP_CHUNK_NODES;
+    for(unsigned chunk = 0; chunk < num_chunks; chunk++)
+    {
+        free((*pool_mgr).node_heap[chunk]);
+    }
+    free((*pool_mgr).node_heap);
+
+    (*pool_mgr).node_heap = NULL;
+    (*pool_mgr).node_heap_capacity = 0;
+    (*pool_mgr).total_nodes = 0;
+}//End _mem_free_node_heap
+
+static node_pt _mem_handle_node(pool_mgr_pt pool_mgr,
+                                mem_alloc_handle_t handle)
+{
+    uint32_t index = handle & MEM_HANDLE_INDEX_MASK;
+
+    if((*pool_mgr).pool.policy == FIXED ||
+       (*pool_mgr).pool.policy == ARENA ||
+       index == 0 || index > (*pool_mgr).top_node)
+    {// not a node this pool has handed out
+        return NULL;
+    }
+
+    node_pt node = _mem_node_at(pool_mgr, index - 1);
+    uint32_t generation =
+            (uint32_t) (*node).generation << MEM_HANDLE_INDEX_BITS;
+
+    if((*node).allocated == 0 || (*node).cached ||
+       generation != (handle & ~MEM_HANDLE_INDEX_MASK))
+    {// the allocation has been deleted since the handle was made
+        return NULL;
+    }
+    return node;
+}//End _mem_handle_node
+
+static node_pt _mem_node_at(pool_mgr_pt pool_mgr, unsigned index)
+{
+    return &(*pool_mgr).node_heap[index / MEM_NODE_HEAP_CHUNK_NODES]
+                                 [index % MEM_NODE_HEAP_CHUNK_NODES];
+}//End _mem_node_at
+
+static node_pt _mem_get_unused_node(pool_mgr_pt pool_mgr)
+{
+    node_pt node = NULL;
+
+    if((*pool_mgr).unused_nodes != NULL)
+    {// reuse a released node
+        node = (*pool_mgr).unused_nodes;
+        (*pool_mgr).unused_nodes = (*node).next;
+        (*pool_mgr).node_reuses++;
+    }
+    else if((*pool_mgr).top_node < (*pool_mgr).total_nodes)
+    {// take a never-used one off the top of the heap
+        node = _mem_node_at(pool_mgr, (*pool_mgr).top_node);
+        (*node).index = (*pool_mgr).top_node;
+        (*pool_mgr).top_node++;
+    }
+    else
+    {// the heap is full, the caller should have expanded it
+        return NULL;
+    }
+
+    (*node).next = NULL;
+    (*node).prev = NULL;
+
+    //   update metadata (used_nodes)
+    (*pool_mgr).used_nodes++;
+    return node;
+}//End _mem_get_unused_node
+
+static void _mem_put_unused_node(pool_mgr_pt pool_mgr, node_pt node)
+{
+    if((*pool_mgr).compact_gap == node)
+    {// compaction steps must not follow it onto the unused list
+        (*pool_mgr).compact_gap = NULL;
+    }
+
+    (*node).allocated = 0;
+    (*node).alloc_record.size = 0;
+    (*node).alloc_record.mem = NULL;
+    (*node).prev = NULL;
+
+    // push on the unused node list
+    (*node).next = (*pool_mgr).unused_nodes;
+    (*pool_mgr).unused_nodes = node;
+    (*pool_mgr).node_releases++;
+
+    //   update metadata (used_nodes)
+    (*pool_mgr).used_nodes--;
+}//End _mem_put_unused_node
+
+static alloc_status _mem_merge_gap(pool_mgr_pt pool_mgr,
+                                   node_pt node_to_delete)
+{
+    // convert to gap node
+    (*node_to_delete).allocated = 0;
+
+    if((*node_to_delete).next != NULL &&
+       (*(*node_to_delete).next).allocated == 0)
+    {//the next node in the list is also a gap, merge into node-to-delete
+        node_pt next_node = (*node_to_delete).next;
+
+        //   remove the next node from gap index
+        _mem_remove_from_gap_ix(pool_mgr,
+                                (*next_node).alloc_record.size,
+                                next_node);
+
+        //   add the size to the node-to-delete
+        (*node_to_delete).alloc_record.size += (*next_node).alloc_record.size;
+
+        //   update linked list:
+        (*node_to_delete).next = (*next_node).next;
+        if((*next_node).next != NULL)
+        {//there exists a node after the next node
+            (*(*next_node).next).prev = node_to_delete;
+        }
+        else
+        {//the next node was the last
+            (*pool_mgr).tail_node = node_to_delete;
+        }
+
+        //   update node as unused (and metadata)
+        _mem_put_unused_node(pool_mgr, next_node);
+    }
+
+    // this merged node-to-delete might need to be added to the gap index
+    // but one more thing to check...
+
+    if((*node_to_delete).prev && (*(*node_to_delete).prev).allocated == 0)
+    {//the previous node in the list is also a gap, merge into previous!
+        node_pt prev_node = (*node_to_delete).prev;
+
+        //   remove the previous node from gap index
+        alloc_status remove_status =
+                _mem_remove_from_gap_ix(pool_mgr,
+                                        (*prev_node).alloc_record.size,
                                         prev_node);
 
-        if(remove_status == ALLOC_FAIL)
-        {//   check success
+        if(remove_status == ALLOC_FAIL)
+        {//   check success
+            return ALLOC_FAIL;
+        }
+
+        //   add the size of node-to-delete to the previous
+        (*prev_node).alloc_record.size += (*node_to_delete).alloc_record.size;
+
+        //   update linked list
+        if((*node_to_delete).next != NULL)
+        {//Delete around this node
+            (*prev_node).next = (*node_to_delete).next;
+            (*(*node_to_delete).next).prev = prev_node;
+        }
+        else
+        {//Delete this node
+            (*prev_node).next = NULL;
+            (*pool_mgr).tail_node = prev_node;
+        }
+
+        //   update node-to-delete as unused (and metadata)
+        _mem_put_unused_node(pool_mgr, node_to_delete);
+
+        //   change the node to add to the previous node!
+        node_to_delete = prev_node;
+    }
+
+    // add the resulting node to the gap index
+    alloc_status add_status = _mem_add_to_gap_ix(pool_mgr,
+                                       (*node_to_delete).alloc_record.size,
+                                        node_to_delete);
+
+    // check success
+    return add_status;
+}//End _mem_merge_gap
+
+// Quick lists hold freed small blocks by exact size. A cached node stays
+// in the node list as an allocation (so its neighbours do not merge into
+// it) but does not count in num_allocs/alloc_size. The lists are linked
+// by node index through gap_slot, which a non-gap node does not use.
+static void _mem_quick_push(pool_mgr_pt pool_mgr, node_pt node)
+{
+    size_t size = (*node).alloc_record.size;
+
+    (*node).cached = 1;
+    (*node).gap_slot = (*pool_mgr).quick_heads[size - 1];
+    (*pool_mgr).quick_heads[size - 1] = (*node).index;
+    (*pool_mgr).quick_blocks++;
+
+    // update metadata (num_allocs, alloc_size)
+    (*pool_mgr).pool.num_allocs--;
+    (*pool_mgr).pool.alloc_size -= size;
+}//End _mem_quick_push
+
+static node_pt _mem_quick_pop(pool_mgr_pt pool_mgr, size_t size)
+{
+    unsigned index = (*pool_mgr).quick_heads[size - 1];
+    if(index == MEM_GAP_IX_NIL)
+    {// no block of this size cached
+        return NULL;
+    }
+
+    node_pt node = _mem_node_at(pool_mgr, index);
+    (*pool_mgr).quick_heads[size - 1] = (*node).gap_slot;
+    (*node).gap_slot = MEM_GAP_IX_NIL;
+    (*node).cached = 0;
+    (*pool_mgr).quick_blocks--;
+    return node;
+}//End _mem_quick_pop
+
+static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr)
+{
+    float active_gaps_percent = (float)
+        (*pool_mgr).pool.num_gaps / (*pool_mgr).gap_ix_capacity;
+    if (active_gaps_percent > MEM_GAP_IX_FILL_FACTOR)
+    {//gap_ix is getting full and needs to expand
+        unsigned old_cap = (*pool_mgr).gap_ix_capacity;
+        unsigned new_cap = MEM_GAP_IX_EXPAND_FACTOR*old_cap;
+        gap_pt new_ix = (gap_pt)
+                realloc((*pool_mgr).gap_ix, new_cap * sizeof(gap_t));
+
+        if(new_ix == NULL)
+        {// check success, the old index is still intact
+            return ALLOC_FAIL;
+        }
+
+        for(unsigned slot = old_cap; slot < new_cap; slot++)
+        {// chain the new slots in front of the free list
+            new_ix[slot].size = 0;
+            new_ix[slot].offset = 0;
+            new_ix[slot].node = MEM_GAP_IX_NIL;
+            new_ix[slot].left = (slot + 1 < new_cap) ?
+                                slot + 1 : (*pool_mgr).gap_ix_free;
+        }
+        (*pool_mgr).gap_ix = new_ix;
+        (*pool_mgr).gap_ix_free = old_cap;
+        (*pool_mgr).gap_ix_capacity = new_cap;
+    }
+    return ALLOC_OK;
+}//End _mem_resize_gap_ix
+
+// Empty the gap index in one pass over its slots, rather than a tree
+// removal per gap, when every gap goes at once.
+static void _mem_clear_gap_ix(pool_mgr_pt pool_mgr)
+{
+    unsigned capacity = (*pool_mgr).gap_ix_capacity;
+    for(unsigned slot = 0; slot < capacity; slot++)
+    {// chain every slot into the free list
+        (*pool_mgr).gap_ix[slot].size = 0;
+        (*pool_mgr).gap_ix[slot].offset = 0;
+        (*pool_mgr).gap_ix[slot].node = MEM_GAP_IX_NIL;
+        (*pool_mgr).gap_ix[slot].left = (slot + 1 < capacity) ?
+                                        slot + 1 : MEM_GAP_IX_NIL;
+    }
+    (*pool_mgr).gap_ix_free = 0;
+    (*pool_mgr).gap_ix_root = MEM_GAP_IX_NIL;
+    (*pool_mgr).pool.num_gaps = 0;
+
+    if((*pool_mgr).tlsf != NULL)
+    {// TLSF, every list empty (stale heads are ignored)
+        memset((*pool_mgr).tlsf, 0, sizeof(tlsf_t));
+    }
+}//End _mem_clear_gap_ix
+
+static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
+                                       size_t size,
+                                       node_pt node)
+{
+
+    // expand the gap index, if necessary (call the function)
+    if(_mem_resize_gap_ix(pool_mgr) != ALLOC_OK)
+    {
+        return ALLOC_FAIL;
+    }
+
+    // take an unused slot off the free list
+    unsigned slot = (*pool_mgr).gap_ix_free;
+    if(slot == MEM_GAP_IX_NIL)
+    {
+        return ALLOC_FAIL;
+    }
+    gap_pt new_gap = &(*pool_mgr).gap_ix[slot];
+    (*pool_mgr).gap_ix_free = (*new_gap).left;
+
+    (*new_gap).size = (gap_off_t) size;
+    (*new_gap).offset = (gap_off_t)
+            ((*node).alloc_record.mem - (*pool_mgr).pool.mem);
+    (*new_gap).node = (*node).index;
+    (*new_gap).max_size = (gap_off_t) size;
+    (*new_gap).left = MEM_GAP_IX_NIL;
+    (*new_gap).right = MEM_GAP_IX_NIL;
+    (*new_gap).height = 1;
+    (*node).gap_slot = slot;
+
+    if((*pool_mgr).tlsf != NULL)
+    {// push it on its size class list
+        _mem_tlsf_insert(pool_mgr, slot);
+    }
+    else
+    {// insert it into the gap tree
+        (*pool_mgr).gap_ix_root =
+                _mem_gap_ix_insert(pool_mgr, (*pool_mgr).gap_ix_root, slot);
+    }
+
+    // update metadata (num_gaps)
+    (*pool_mgr).pool.num_gaps++;
+
+    return ALLOC_OK;
+}//End _mem_add_to_gap_ix
+
+static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
+                                            size_t size,
+                                            node_pt node)
+{
+    unsigned position = MEM_GAP_IX_NIL;
+    if((*pool_mgr).tlsf != NULL)
+    {// the node knows its slot, unlink it from its size class list
+        position = (*node).gap_slot;
+        if(position == MEM_GAP_IX_NIL ||
+           (*pool_mgr).gap_ix[position].node != (*node).index)
+        {//the node is not in the gap index
+            return ALLOC_FAIL;
+        }
+        _mem_tlsf_remove(pool_mgr, position);
+    }
+    else
+    {// the (size, offset, node) key is unique, look the entry up by it
+        (*pool_mgr).gap_ix_root =
+                _mem_gap_ix_delete(pool_mgr, (*pool_mgr).gap_ix_root, size,
+                                   (size_t) ((*node).alloc_record.mem -
+                                             (*pool_mgr).pool.mem),
+                                   (*node).index, &position);
+    }
+    if(position == MEM_GAP_IX_NIL)
+    {//didn't find the node in the gap index
+        return ALLOC_FAIL;
+    }
+    (*node).gap_slot = MEM_GAP_IX_NIL;
+
+    // update metadata (num_gaps)
+    (*pool_mgr).pool.num_gaps--;
+
+    // zero out the entry and return it to the free list
+    gap_pt to_delete = &(*pool_mgr).gap_ix[position];
+    (*to_delete).size = 0;
+    (*to_delete).offset = 0;
+    (*to_delete).node = MEM_GAP_IX_NIL;
+    (*to_delete).right = MEM_GAP_IX_NIL;
+    (*to_delete).left = (*pool_mgr).gap_ix_free;
+    (*pool_mgr).gap_ix_free = position;
+    return ALLOC_OK;
+}//End _mem_remove_from_gap_ix
+
+// gap index order: FIRST_FIT and NEXT_FIT pools are ordered by address
+// (offset), BEST_FIT pools ascending by size, ties broken by lower
+// address (offset). A 0-byte gap shares its offset with the gap or
+// allocation after it, so address ties go to the smaller gap, which keeps
+// the gaps in end-address order too, and the node heap index breaks the
+// last ties and keeps every key unique.
+static int _mem_cmp_gap_ix(pool_mgr_pt pool_mgr,
+                           size_t size_a, size_t offset_a, unsigned node_a,
+                           size_t size_b, size_t offset_b, unsigned node_b)
+{
+    if((*pool_mgr).pool.policy != FIRST_FIT &&
+       (*pool_mgr).pool.policy != NEXT_FIT && size_a != size_b)
+    {// the smaller gap comes first
+        return (size_a < size_b) ? -1 : 1;
+    }
+    if(offset_a != offset_b)
+    {// equal sizes, the gap with the lower pool address comes first
+        return (offset_a < offset_b) ? -1 : 1;
+    }
+    if(size_a != size_b)
+    {// same address, the 0-byte gap comes first
+        return (size_a < size_b) ? -1 : 1;
+    }
+    if(node_a != node_b)
+    {// same place, told apart by node
+        return (node_a < node_b) ? -1 : 1;
+    }
+    return 0;
+}//End _mem_cmp_gap_ix
+
+static unsigned _mem_gap_ix_height(pool_mgr_pt pool_mgr, unsigned slot)
+{
+    return (slot == MEM_GAP_IX_NIL) ? 0 : (*pool_mgr).gap_ix[slot].height;
+}//End _mem_gap_ix_height
+
+static void _mem_gap_ix_update(pool_mgr_pt pool_mgr, unsigned slot)
+{
+    gap_pt gap = &(*pool_mgr).gap_ix[slot];
+    unsigned left_height = _mem_gap_ix_height(pool_mgr, (*gap).left);
+    unsigned right_height = _mem_gap_ix_height(pool_mgr, (*gap).right);
+    (*gap).height = 1 + ((left_height > right_height) ?
+                         left_height : right_height);
+
+    // keep the subtree maximum for the FIRST_FIT descent
+    (*gap).max_size = (*gap).size;
+    if((*gap).left != MEM_GAP_IX_NIL &&
+       (*pool_mgr).gap_ix[(*gap).left].max_size > (*gap).max_size)
+    {
+        (*gap).max_size = (*pool_mgr).gap_ix[(*gap).left].max_size;
+    }
+    if((*gap).right != MEM_GAP_IX_NIL &&
+       (*pool_mgr).gap_ix[(*gap).right].max_size > (*gap).max_size)
+    {
+        (*gap).max_size = (*pool_mgr).gap_ix[(*gap).right].max_size;
+    }
+}//End _mem_gap_ix_update
+
+static unsigned _mem_gap_ix_rotate_left(pool_mgr_pt pool_mgr, unsigned slot)
+{
+    unsigned pivot = (*pool_mgr).gap_ix[slot].right;
+    (*pool_mgr).gap_ix[slot].right = (*pool_mgr).gap_ix[pivot].left;
+    (*pool_mgr).gap_ix[pivot].left = slot;
+    _mem_gap_ix_update(pool_mgr, slot);
+    _mem_gap_ix_update(pool_mgr, pivot);
+    return pivot;
+}//End _mem_gap_ix_rotate_left
+
+static unsigned _mem_gap_ix_rotate_right(pool_mgr_pt pool_mgr, unsigned slot)
+{
+    unsigned pivot = (*pool_mgr).gap_ix[slot].left;
+    (*pool_mgr).gap_ix[slot].left = (*pool_mgr).gap_ix[pivot].right;
+    (*pool_mgr).gap_ix[pivot].right = slot;
+    _mem_gap_ix_update(pool_mgr, slot);
+    _mem_gap_ix_update(pool_mgr, pivot);
+    return pivot;
+}//End _mem_gap_ix_rotate_right
+
+static unsigned _mem_gap_ix_rebalance(pool_mgr_pt pool_mgr, unsigned slot)
+{
+    gap_pt gap = &(*pool_mgr).gap_ix[slot];
+    _mem_gap_ix_update(pool_mgr, slot);
+
+    int balance = (int) _mem_gap_ix_height(pool_mgr, (*gap).left) -
+                  (int) _mem_gap_ix_height(pool_mgr, (*gap).right);
+
+    if(balance > 1)
+    {// left-heavy, straighten a left-right zig-zag first
+        unsigned left = (*gap).left;
+        if(_mem_gap_ix_height(pool_mgr, (*pool_mgr).gap_ix[left].left) <
+           _mem_gap_ix_height(pool_mgr, (*pool_mgr).gap_ix[left].right))
+        {
+            (*gap).left = _mem_gap_ix_rotate_left(pool_mgr, left);
+        }
+        return _mem_gap_ix_rotate_right(pool_mgr, slot);
+    }
+    if(balance < -1)
+    {// right-heavy, straighten a right-left zig-zag first
+        unsigned right = (*gap).right;
+        if(_mem_gap_ix_height(pool_mgr, (*pool_mgr).gap_ix[right].right) <
+           _mem_gap_ix_height(pool_mgr, (*pool_mgr).gap_ix[right].left))
+        {
+            (*gap).right = _mem_gap_ix_rotate_right(pool_mgr, right);
+        }
+        return _mem_gap_ix_rotate_left(pool_mgr, slot);
+    }
+    return slot;
+}//End _mem_gap_ix_rebalance
+
+static unsigned _mem_gap_ix_insert(pool_mgr_pt pool_mgr,
+                                   unsigned root,
+                                   unsigned slot)
+{
+    if(root == MEM_GAP_IX_NIL)
+    {// empty subtree, the new entry becomes its root
+        return slot;
+    }
+
+    gap_pt gap = &(*pool_mgr).gap_ix[root];
+    gap_pt new_gap = &(*pool_mgr).gap_ix[slot];
+    if(_mem_cmp_gap_ix(pool_mgr,
+                       (*new_gap).size, (*new_gap).offset, (*new_gap).node,
+                       (*gap).size, (*gap).offset, (*gap).node) < 0)
+    {
+        (*gap).left = _mem_gap_ix_insert(pool_mgr, (*gap).left, slot);
+    }
+    else
+    {
+        (*gap).right = _mem_gap_ix_insert(pool_mgr, (*gap).right, slot);
+    }
+    return _mem_gap_ix_rebalance(pool_mgr, root);
+}//End _mem_gap_ix_insert
+
+static unsigned _mem_gap_ix_delete(pool_mgr_pt pool_mgr,
+                                   unsigned root,
+                                   size_t size,
+                                   size_t offset,
+                                   unsigned node,
+                                   unsigned *removed)
+{
+    if(root == MEM_GAP_IX_NIL)
+    {// not found, *removed stays NIL
+        return root;
+    }
+
+    gap_pt gap = &(*pool_mgr).gap_ix[root];
+    int cmp = _mem_cmp_gap_ix(pool_mgr, size, offset, node,
+                              (*gap).size, (*gap).offset, (*gap).node);
+    if(cmp < 0)
+    {
+        (*gap).left = _mem_gap_ix_delete(pool_mgr, (*gap).left,
+                                         size, offset, node, removed);
+    }
+    else if(cmp > 0)
+    {
+        (*gap).right = _mem_gap_ix_delete(pool_mgr, (*gap).right,
+                                          size, offset, node, removed);
+    }
+    else
+    {// found it, unlink the entry from the tree
+        *removed = root;
+        if((*gap).left == MEM_GAP_IX_NIL)
+        {
+            return (*gap).right;
+        }
+        if((*gap).right == MEM_GAP_IX_NIL)
+        {
+            return (*gap).left;
+        }
+
+        //   two subtrees, the in-order successor takes its place
+        unsigned successor = MEM_GAP_IX_NIL;
+        unsigned right = _mem_gap_ix_delete_min(pool_mgr, (*gap).right,
+                                                &successor);
+        (*pool_mgr).gap_ix[successor].left = (*gap).left;
+        (*pool_mgr).gap_ix[successor].right = right;
+        root = successor;
+    }
+    return _mem_gap_ix_rebalance(pool_mgr, root);
+}//End _mem_gap_ix_delete
+
+static unsigned _mem_gap_ix_delete_min(pool_mgr_pt pool_mgr,
+                                       unsigned root,
+                                       unsigned *removed)
+{
+    gap_pt gap = &(*pool_mgr).gap_ix[root];
+    if((*gap).left == MEM_GAP_IX_NIL)
+    {// leftmost entry, its right subtree moves up
+        *removed = root;
+        return (*gap).right;
+    }
+    (*gap).left = _mem_gap_ix_delete_min(pool_mgr, (*gap).left, removed);
+    return _mem_gap_ix_rebalance(pool_mgr, root);
+}//End _mem_gap_ix_delete_min
+
+static node_pt _mem_gap_ix_best_fit(pool_mgr_pt pool_mgr, size_t size)
+{
+    // the leftmost entry of size >= size is the smallest sufficient gap
+    // with the lowest address, same as the first match in sorted order
+    node_pt best = NULL;
+    unsigned slot = (*pool_mgr).gap_ix_root;
+    while(slot != MEM_GAP_IX_NIL)
+    {
+        gap_pt gap = &(*pool_mgr).gap_ix[slot];
+        if((*gap).size >= size)
+        {// sufficient, but there may be a smaller one to the left
+            best = _mem_node_at(pool_mgr, (*gap).node);
+            slot = (*gap).left;
+        }
+        else
+        {
+            slot = (*gap).right;
+        }
+    }
+    return best;
+}//End _mem_gap_ix_best_fit
+
+static node_pt _mem_gap_ix_first_fit(pool_mgr_pt pool_mgr, size_t size)
+{
+    unsigned slot = (*pool_mgr).gap_ix_root;
+    if(slot == MEM_GAP_IX_NIL || (*pool_mgr).gap_ix[slot].max_size < size)
+    {// no gap in the pool is big enough
+        return NULL;
+    }
+
+    // descend toward the lowest address, the subtree always has a fit
+    while(1)
+    {
+        gap_pt gap = &(*pool_mgr).gap_ix[slot];
+        if((*gap).left != MEM_GAP_IX_NIL &&
+           (*pool_mgr).gap_ix[(*gap).left].max_size >= size)
+        {// a lower-address gap fits
+            slot = (*gap).left;
+        }
+        else if((*gap).size >= size)
+        {// this is the lowest-address gap that fits
+            return _mem_node_at(pool_mgr, (*gap).node);
+        }
+        else
+        {// it can only be at a higher address
+            slot = (*gap).right;
+        }
+    }
+}//End _mem_gap_ix_first_fit
+
+static node_pt _mem_gap_ix_next_fit(pool_mgr_pt pool_mgr, size_t size)
+{
+    // the lowest-address sufficient gap that ends after the rover
+    unsigned slot = _mem_gap_ix_fit_after(pool_mgr, (*pool_mgr).gap_ix_root,
+                                          size, (*pool_mgr).rover);
+    if(slot == MEM_GAP_IX_NIL)
+    {// nothing past the rover, wrap around to the start of the pool
+        return _mem_gap_ix_first_fit(pool_mgr, size);
+    }
+    return _mem_node_at(pool_mgr, (*pool_mgr).gap_ix[slot].node);
+}//End _mem_gap_ix_next_fit
+
+static unsigned _mem_gap_ix_fit_after(pool_mgr_pt pool_mgr,
+                                      unsigned root,
+                                      size_t size,
+                                      char *from)
+{
+    if(root == MEM_GAP_IX_NIL || (*pool_mgr).gap_ix[root].max_size < size)
+    {// no gap in this subtree is big enough
+        return MEM_GAP_IX_NIL;
+    }
+
+    // gaps do not overlap, so they are in the same order by end address;
+    // the rover may sit inside a gap that was merged after it was set
+    gap_pt gap = &(*pool_mgr).gap_ix[root];
+    if((*pool_mgr).pool.mem + (*gap).offset + (*gap).size <= from)
+    {// this gap and the whole left subtree end before the rover
+        return _mem_gap_ix_fit_after(pool_mgr, (*gap).right, size, from);
+    }
+
+    unsigned slot = _mem_gap_ix_fit_after(pool_mgr, (*gap).left, size, from);
+    if(slot != MEM_GAP_IX_NIL)
+    {// a lower-address gap past the rover fits
+        return slot;
+    }
+    if((*gap).size >= size)
+    {
+        return root;
+    }
+    return _mem_gap_ix_fit_after(pool_mgr, (*gap).right, size, from);
+}//End _mem_gap_ix_fit_after
+
+static unsigned _mem_tlsf_ctz(unsigned long long bits)
+{
+    // bits must be non-zero
+#if defined(__GNUC__)
+    return (unsigned) __builtin_ctzll(bits);
+#else
+    unsigned index = 0;
+    while((bits & 1) == 0)
+    {
+        bits >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}//End _mem_tlsf_ctz
+
+static unsigned _mem_tlsf_msb(size_t size)
+{
+    // size must be non-zero
+#if defined(__GNUC__)
+    return (unsigned) (63 - __builtin_clzll((unsigned long long) size));
+#else
+    unsigned index = 0;
+    while(size >>= 1)
+    {
+        index++;
+    }
+    return index;
+#endif
+}//End _mem_tlsf_msb
+
+static void _mem_tlsf_mapping(size_t size, unsigned *fl, unsigned *sl)
+{
+    if(size < MEM_TLSF_SL_COUNT)
+    {// small gaps get one list per size in the first row
+        *fl = 0;
+        *sl = (unsigned) size;
+    }
+    else
+    {// row by power of two, column by the next SL_LOG2 bits
+        unsigned msb = _mem_tlsf_msb(size);
+        *fl = msb - MEM_TLSF_SL_LOG2 + 1;
+        *sl = (unsigned) (size >> (msb - MEM_TLSF_SL_LOG2)) -
+              MEM_TLSF_SL_COUNT;
+    }
+}//End _mem_tlsf_mapping
+
+static void _mem_tlsf_insert(pool_mgr_pt pool_mgr, unsigned slot)
+{
+    tlsf_pt tlsf = (*pool_mgr).tlsf;
+    gap_pt gap = &(*pool_mgr).gap_ix[slot];
+    unsigned fl, sl;
+    _mem_tlsf_mapping((*gap).size, &fl, &sl);
+
+    // push on the front of the list (left: prev, right: next)
+    unsigned head = (*tlsf).heads[fl][sl];
+    (*gap).left = MEM_GAP_IX_NIL;
+    (*gap).right = head;
+    if((*tlsf).sl_bitmap[fl] & (1u << sl))
+    {
+        (*pool_mgr).gap_ix[head].left = slot;
+    }
+    else
+    {// the list was empty, its head is stale
+        (*gap).right = MEM_GAP_IX_NIL;
+    }
+    (*tlsf).heads[fl][sl] = slot;
+
+    // mark the list and the row as non-empty
+    (*tlsf).sl_bitmap[fl] |= 1u << sl;
+    (*tlsf).fl_bitmap |= 1ull << fl;
+}//End _mem_tlsf_insert
+
+static void _mem_tlsf_remove(pool_mgr_pt pool_mgr, unsigned slot)
+{
+    tlsf_pt tlsf = (*pool_mgr).tlsf;
+    gap_pt gap = &(*pool_mgr).gap_ix[slot];
+    unsigned fl, sl;
+    _mem_tlsf_mapping((*gap).size, &fl, &sl);
+
+    if((*gap).right != MEM_GAP_IX_NIL)
+    {
+        (*pool_mgr).gap_ix[(*gap).right].left = (*gap).left;
+    }
+    if((*gap).left != MEM_GAP_IX_NIL)
+    {
+        (*pool_mgr).gap_ix[(*gap).left].right = (*gap).right;
+    }
+    else
+    {// it was the head
+        (*tlsf).heads[fl][sl] = (*gap).right;
+        if((*gap).right == MEM_GAP_IX_NIL)
+        {// the list is now empty, and maybe the whole row
+            (*tlsf).sl_bitmap[fl] &= ~(1u << sl);
+            if((*tlsf).sl_bitmap[fl] == 0)
+            {
+                (*tlsf).fl_bitmap &= ~(1ull << fl);
+            }
+        }
+    }
+}//End _mem_tlsf_remove
+
+static node_pt _mem_tlsf_find(pool_mgr_pt pool_mgr, size_t size)
+{
+    tlsf_pt tlsf = (*pool_mgr).tlsf;
+    unsigned fl, sl;
+
+    // round the request up to the next list boundary, so that any gap
+    // on the list found is big enough without searching it
+    size_t round = 0;
+    if(size >= MEM_TLSF_SL_COUNT)
+    {
+        round = ((size_t) 1 << (_mem_tlsf_msb(size) - MEM_TLSF_SL_LOG2)) - 1;
+    }
+    if(size <= SIZE_MAX - round)
+    {
+        _mem_tlsf_mapping(size + round, &fl, &sl);
+
+        // first non-empty list at or after (fl, sl)
+        unsigned sl_map = (*tlsf).sl_bitmap[fl] & (~0u << sl);
+        if(sl_map == 0)
+        {// nothing left in this row, take the next non-empty row
+            unsigned long long fl_map = (fl + 1 < MEM_TLSF_FL_COUNT) ?
+                    (*tlsf).fl_bitmap & (~0ull << (fl + 1)) : 0;
+            if(fl_map != 0)
+            {
+                fl = _mem_tlsf_ctz(fl_map);
+                sl_map = (*tlsf).sl_bitmap[fl];
+            }
+        }
+        if(sl_map != 0)
+        {
+            sl = _mem_tlsf_ctz(sl_map);
+            return _mem_node_at(pool_mgr,
+                                (*pool_mgr).gap_ix[(*tlsf).heads[fl][sl]].node);
+        }
+    }
+
+    // nothing a class up, the head of the request's own class may still
+    // fit (e.g. the whole pool); check it, but never walk the list
+    _mem_tlsf_mapping(size, &fl, &sl);
+    if((*tlsf).sl_bitmap[fl] & (1u << sl))
+    {
+        gap_pt gap = &(*pool_mgr).gap_ix[(*tlsf).heads[fl][sl]];
+        if((*gap).size >= size)
+        {
+            return _mem_node_at(pool_mgr, (*gap).node);
+        }
+    }
+    return NULL;
+}//End _mem_tlsf_find
+
+// BUDDY pools keep every gap as a free power-of-two block aligned to its
+// size (relative to pool.mem). Free blocks sit on the TLSF lists, where
+// each power of two has a list of its own, so the smallest non-empty
+// order is found with the same bitmaps. A block's buddy is always its
+// neighbour in the node list, so no split/merge bitmaps are needed.
+static alloc_status _mem_buddy_init(pool_mgr_pt pool_mgr)
+{
+    size_t size = (*pool_mgr).pool.total_size;
+    size_t offset = 0;
+    node_pt prev_node = NULL;
+
+    // one top block per set bit of size, largest first, so that every
+    // block's offset is a multiple of its size
+    for(int order = 63; order >= 0; order--)
+    {
+        size_t block_size = (size_t) 1 << order;
+        if((size & block_size) == 0)
+        {
+            continue;
+        }
+
+        if(_mem_resize_node_heap(pool_mgr) != ALLOC_OK)
+        {// one node per set bit can outgrow the first chunk
             return ALLOC_FAIL;
         }
 
-        //   add the size of node-to-delete to the previous
-        (*prev_node).alloc_record.size += (*alloc).size;
+        node_pt node = _mem_get_unused_node(pool_mgr);
+        (*node).alloc_record.size = block_size;
+        (*node).alloc_record.mem = (*pool_mgr).pool.mem + offset;
+        (*node).allocated = 0;
+        (*node).prev = prev_node;
+        if(prev_node != NULL)
+        {
+            (*prev_node).next = node;
+        }
+        else
+        {
+            (*pool_mgr).head_node = node;
+        }
+
+        if(_mem_add_to_gap_ix(pool_mgr, block_size, node) != ALLOC_OK)
+        {
+            return ALLOC_FAIL;
+        }
+        prev_node = node;
+        (*pool_mgr).tail_node = node;
+        offset += block_size;
+    }
+    return ALLOC_OK;
+}//End _mem_buddy_init
 
-        //   update node-to-delete as unused
-        (*node_to_delete).used = 0;
-        (*node_to_delete).alloc_record.size = 0;
-        (*node_to_delete).alloc_record.mem = NULL;
+static node_pt _mem_buddy_alloc(pool_mgr_pt pool_mgr, size_t size)
+{
+    // round the request up to a power of two
+    size_t block_size = 1;
+    if(size > 1)
+    {
+        unsigned order = _mem_tlsf_msb(size - 1) + 1;
+        if(order >= 8 * sizeof(size_t))
+        {
+            return NULL;
+        }
+        block_size = (size_t) 1 << order;
+    }
 
-        //   update metadata (used_nodes)
-        (*pool_manager).used_nodes--;
+    // smallest free block of at least that order
+    node_pt node = _mem_tlsf_find(pool_mgr, block_size);
+    if(node == NULL)
+    {
+        return NULL;
+    }
 
-        //   update linked list
-        if((*node_to_delete).next != NULL)
-        {//Delete around this node
-            (*prev_node).next = (*node_to_delete).next;
-            (*(*node_to_delete).next).prev = prev_node;
+    // make sure there is a spare node for each split, up front
+    unsigned splits = _mem_tlsf_msb((*node).alloc_record.size) -
+                      _mem_tlsf_msb(block_size);
+    while((*pool_mgr).total_nodes - (*pool_mgr).used_nodes < splits)
+    {
+        if(_mem_expand_node_heap(pool_mgr) != ALLOC_OK)
+        {
+            return NULL;
+        }
+    }
+
+    _mem_remove_from_gap_ix(pool_mgr, (*node).alloc_record.size, node);
+
+    while((*node).alloc_record.size > block_size)
+    {// split off the upper half as a free buddy
+        size_t half = (*node).alloc_record.size / 2;
+        node_pt buddy = _mem_get_unused_node(pool_mgr);
+
+        (*node).alloc_record.size = half;
+        (*buddy).alloc_record.size = half;
+        (*buddy).alloc_record.mem = (*node).alloc_record.mem + half;
+        (*buddy).allocated = 0;
+
+        (*buddy).prev = node;
+        (*buddy).next = (*node).next;
+        if((*node).next != NULL)
+        {
+            (*(*node).next).prev = buddy;
         }
         else
-        {//Delete this node
-            (*prev_node).next = NULL;
+        {
+            (*pool_mgr).tail_node = buddy;
         }
-        (*node_to_delete).next = NULL;
-        (*node_to_delete).prev = NULL;
+        (*node).next = buddy;
 
-        //   change the node to add to the previous node!
-        node_to_delete = prev_node;
+        _mem_add_to_gap_ix(pool_mgr, half, buddy);
     }
 
-    // add the resulting node to the gap index
-    alloc_status add_status = _mem_add_to_gap_ix(pool_manager,
-                                       (*node_to_delete).alloc_record.size,
-                                        node_to_delete);
+    // the whole block is the allocation
+    (*node).allocated = 1;
+    (*pool_mgr).pool.num_allocs++;
+    (*pool_mgr).pool.alloc_size += block_size;
+    return node;
+}//End _mem_buddy_alloc
 
-    // check success
-    return add_status;
-}//End mem_del_alloc
+static alloc_status _mem_buddy_free(pool_mgr_pt pool_mgr, node_pt node)
+{
+    (*node).allocated = 0;
+    (*pool_mgr).pool.num_allocs--;
+    (*pool_mgr).pool.alloc_size -= (*node).alloc_record.size;
 
-void mem_inspect_pool(pool_pt pool,
-                      pool_segment_pt *segments,
-                      unsigned *num_segments)
+    while(1)
+    {// merge with the buddy as long as it is a whole free block
+        size_t block_size = (*node).alloc_record.size;
+        size_t offset = (*node).alloc_record.mem - (*pool_mgr).pool.mem;
+        node_pt buddy = (offset & block_size) ? (*node).prev : (*node).next;
+
+        if(buddy == NULL || (*buddy).allocated ||
+           (*buddy).alloc_record.size != block_size)
+        {// buddy is allocated or split (or past the end of the pool)
+            break;
+        }
+
+        if(_mem_remove_from_gap_ix(pool_mgr, block_size, buddy) != ALLOC_OK)
+        {
+            return ALLOC_FAIL;
+        }
+
+        //   the lower block absorbs the upper one
+        node_pt lower = (offset & block_size) ? buddy : node;
+        node_pt upper = (offset & block_size) ? node : buddy;
+        (*lower).alloc_record.size = 2 * block_size;
+        (*lower).next = (*upper).next;
+        if((*upper).next != NULL)
+        {
+            (*(*upper).next).prev = lower;
+        }
+        else
+        {
+            (*pool_mgr).tail_node = lower;
+        }
+
+        //   update upper as unused (and metadata)
+        _mem_put_unused_node(pool_mgr, upper);
+
+        node = lower;
+    }
+
+    return _mem_add_to_gap_ix(pool_mgr, (*node).alloc_record.size, node);
+}//End _mem_buddy_free
+
+// FIXED pools hand out records[i] for the object at pool.mem + i * stride.
+// A free object stores the next free object in its first bytes, and the
+// tail of the pool that has never been handed out is carved off in
+// order, so open, alloc and free are all O(1).
+static alloc_pt _mem_slab_alloc(pool_mgr_pt pool_mgr, size_t size)
 {
-    // get the mgr from the pool
-    pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
+    slab_pt slab = (*pool_mgr).slab;
+    char *object = NULL;
 
-    // allocate the segments array with size == used_nodes
+    if(size > (*slab).obj_size)
+    {// the object is too small for the request
+        return NULL;
+    }
+
+    if((*slab).free_list != NULL)
+    {// reuse the most recently freed object
+        object = (*slab).free_list;
+        (*slab).free_list = *(char **) object;
+    }
+    else if((*slab).num_carved < (*slab).num_objs)
+    {// carve a new one off the untouched tail
+        object = (*pool_mgr).pool.mem +
+                 (size_t) (*slab).num_carved * (*slab).obj_size;
+        (*slab).num_carved++;
+    }
+    else
+    {// pool is full
+        return NULL;
+    }
+
+    long index = (long) ((object - (*pool_mgr).pool.mem) / (*slab).obj_size);
+    alloc_pt record = &(*slab).records[index];
+
+    // keep num_gaps in step with the runs of free objects
+    int left_free = _mem_slab_is_free(pool_mgr, index - 1);
+    int right_free = _mem_slab_is_free(pool_mgr, index + 1);
+    if(left_free && right_free)
+    {// splits a gap in two
+        (*pool_mgr).pool.num_gaps++;
+    }
+    else if(!left_free && !right_free)
+    {// fills a gap of one
+        (*pool_mgr).pool.num_gaps--;
+    }
+
+    (*record).size = (*slab).obj_size;
+    (*record).mem = object;
+
+    // update metadata (num_allocs, alloc_size)
+    (*pool_mgr).pool.num_allocs++;
+    (*pool_mgr).pool.alloc_size += (*slab).obj_size;
+
+    return record;
+}//End _mem_slab_alloc
+
+static alloc_status _mem_slab_free(pool_mgr_pt pool_mgr, alloc_pt alloc)
+{
+    slab_pt slab = (*pool_mgr).slab;
+    long index = (long) (alloc - (*slab).records);
+
+    if(index < 0 || index >= (long) (*slab).num_objs || (*alloc).mem == NULL)
+    {// not a live record of this pool
+        return ALLOC_FAIL;
+    }
+
+    // push the object on the free list
+    char *object = (*alloc).mem;
+    *(char **) object = (*slab).free_list;
+    (*slab).free_list = object;
+    (*alloc).mem = NULL;
+    (*alloc).size = 0;
+
+    // keep num_gaps in step with the runs of free objects
+    int left_free = _mem_slab_is_free(pool_mgr, index - 1);
+    int right_free = _mem_slab_is_free(pool_mgr, index + 1);
+    if(left_free && right_free)
+    {// joins two gaps
+        (*pool_mgr).pool.num_gaps--;
+    }
+    else if(!left_free && !right_free)
+    {// a new gap of one
+        (*pool_mgr).pool.num_gaps++;
+    }
+
+    // update metadata (num_allocs, alloc_size)
+    (*pool_mgr).pool.num_allocs--;
+    (*pool_mgr).pool.alloc_size -= (*slab).obj_size;
+
+    return ALLOC_OK;
+}//End _mem_slab_free
+
+static int _mem_slab_is_free(pool_mgr_pt pool_mgr, long index)
+{
+    slab_pt slab = (*pool_mgr).slab;
+    if(index < 0 || index >= (long) (*slab).num_objs)
+    {// past either end of the pool
+        return 0;
+    }
+    return (*slab).records[index].mem == NULL;
+}//End _mem_slab_is_free
+
+static void _mem_slab_inspect(pool_mgr_pt pool_mgr,
+                              pool_segment_pt *segments,
+                              unsigned *num_segments)
+{
+    slab_pt slab = (*pool_mgr).slab;
+    unsigned count = (*pool_mgr).pool.num_allocs + (*pool_mgr).pool.num_gaps;
+
+    // allocate the segments array with size == allocs + gaps
     pool_segment_pt segs = (pool_segment_pt)
-            calloc((*pool_manager).used_nodes, sizeof(pool_segment_t));
+            calloc(count, sizeof(pool_segment_t));
 
     if(segs == NULL)
     {// check successful
         return;
     }
 
-    node_pt current_node = (*pool_manager).node_heap;
-    int index = 0;
-    while(current_node != NULL)
-    {//   loop through the node heap and the segments array
-        //for each node, write the size and allocated in the segment
-        segs[index].size = (*current_node).alloc_record.size;
-        segs[index].allocated = (*current_node).allocated;
-        index++;
-        current_node = (*current_node).next;
+    int index = -1;
+    for(unsigned parser = 0; parser < (*slab).num_objs; parser++)
+    {// one segment per object, runs of free objects make one gap
+        int allocated = (*slab).records[parser].mem != NULL;
+        if(allocated || index < 0 || segs[index].allocated)
+        {
+            index++;
+            segs[index].allocated = (unsigned long) allocated;
+        }
+        segs[index].size += (*slab).obj_size;
     }
 
     // "return" the values:
     *segments = segs;
-    *num_segments = (*pool_manager).used_nodes;
+    *num_segments = count;
+}//End _mem_slab_inspect
 
-}//End mem_inspect_pool
+// ARENA pools hand out pool.mem from a bump offset. The records live in
+// chunks of their own, in allocation (and so address) order, and only
+// the latest allocation can be freed on its own; mem_pool_reset() frees
+// them all at once by rewinding the offset and the record count.
+static alloc_status _mem_arena_init(pool_mgr_pt pool_mgr)
+{
+    // allocate the arena descriptor and the chunk slots
+    arena_pt arena = (arena_pt) calloc(1, sizeof(arena_t));
 
+    if(arena == NULL)
+    {// check success
+        return ALLOC_FAIL;
+    }
 
+    (*arena).chunks = (alloc_pt*)
+            calloc(MEM_ARENA_INIT_CHUNKS, sizeof(alloc_pt));
 
-/***********************************/
-/*                                 */
-/* Definitions of static functions */
-/*                                 */
-/***********************************/
-static alloc_status _mem_resize_pool_store()
-{
-    float size_used_percent = (float)
-        pool_store_size / pool_store_capacity;
-    if (size_used_percent > MEM_POOL_STORE_FILL_FACTOR)
-    {//pool_store is getting full and needs to expand
-        unsigned new_cap = MEM_POOL_STORE_EXPAND_FACTOR*pool_store_capacity;
-        pool_store = (pool_mgr_pt*)
-                realloc(pool_store, new_cap * sizeof(pool_mgr_pt));
-        pool_store_capacity = new_cap;
+    if((*arena).chunks == NULL)
+    {// check success, on error deallocate descriptor
+        free(arena);
+        return ALLOC_FAIL;
     }
+    (*arena).chunk_capacity = MEM_ARENA_INIT_CHUNKS;
+
+    (*pool_mgr).arena = arena;
+
+    // the whole pool is one gap (none if it is empty)
+    (*pool_mgr).pool.num_gaps = ((*pool_mgr).pool.total_size > 0);
+
     return ALLOC_OK;
-}//End _mem_resize_pool_store
+}//End _mem_arena_init
 
-static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr)
+static alloc_pt _mem_arena_alloc(pool_mgr_pt pool_mgr, size_t size)
 {
-    float nodes_used_percent = (float)
-        (*pool_mgr).used_nodes / (*pool_mgr).total_nodes;
-    if (nodes_used_percent > MEM_NODE_HEAP_FILL_FACTOR)
-    {//node_heap is getting full and needs to expand
-        unsigned new_cap =
-                MEM_NODE_HEAP_EXPAND_FACTOR*(*pool_mgr).total_nodes;
-        (*pool_mgr).node_heap = (node_pt)
-                realloc((*pool_mgr).node_heap, new_cap * sizeof(node_t));
-        (*pool_mgr).total_nodes = new_cap;
+    arena_pt arena = (*pool_mgr).arena;
+
+    if(size > (*pool_mgr).pool.total_size - (*arena).offset)
+    {// the rest of the pool is too small for the request
+        return NULL;
     }
-    return ALLOC_OK;
-}//End _mem_resize_node_heap
 
-static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr)
-{
-    float active_gaps_percent = (float)
-        (*pool_mgr).pool.num_gaps / (*pool_mgr).gap_ix_capacity;
-    if (active_gaps_percent > MEM_GAP_IX_FILL_FACTOR)
-    {//gap_ix is getting full and needs to expand
-        unsigned new_cap =
-                MEM_GAP_IX_EXPAND_FACTOR*(*pool_mgr).gap_ix_capacity;
-        (*pool_mgr).gap_ix = (gap_pt)
-                realloc((*pool_mgr).gap_ix, new_cap * sizeof(gap_t));
-        (*pool_mgr).gap_ix_capacity = new_cap;
+    unsigned chunk = (*arena).num_records / MEM_ARENA_CHUNK_RECORDS;
+    if(chunk == (*arena).num_chunks)
+    {// every record is taken, add a chunk
+        if(chunk == (*arena).chunk_capacity)
+        {// expand the chunk slots first
+            unsigned capacity =
+                    (*arena).chunk_capacity * MEM_ARENA_EXPAND_FACTOR;
+            alloc_pt *chunks = (alloc_pt*)
+                    realloc((*arena).chunks, capacity * sizeof(alloc_pt));
+
+            if(chunks == NULL)
+            {// check success
+                return NULL;
+            }
+            (*arena).chunks = chunks;
+            (*arena).chunk_capacity = capacity;
+        }
+
+        (*arena).chunks[chunk] = (alloc_pt)
+                calloc(MEM_ARENA_CHUNK_RECORDS, sizeof(alloc_t));
+
+        if((*arena).chunks[chunk] == NULL)
+        {// check success
+            return NULL;
+        }
+        (*arena).num_chunks++;
     }
-    return ALLOC_OK;
-}//End _mem_resize_gap_ix
 
-static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
-                                       size_t size,
-                                       node_pt node)
+    alloc_pt record = _mem_arena_record(pool_mgr, (*arena).num_records);
+    (*record).mem = (*pool_mgr).pool.mem + (*arena).offset;
+    (*record).size = size;
+    (*arena).num_records++;
+    (*arena).offset += size;
+
+    // update metadata (num_allocs, alloc_size, the trailing gap)
+    (*pool_mgr).pool.num_allocs++;
+    (*pool_mgr).pool.alloc_size += size;
+    (*pool_mgr).pool.num_gaps =
+            ((*arena).offset < (*pool_mgr).pool.total_size);
+
+    return record;
+}//End _mem_arena_alloc
+
+static alloc_status _mem_arena_free(pool_mgr_pt pool_mgr, alloc_pt alloc)
 {
+    arena_pt arena = (*pool_mgr).arena;
 
-    // expand the gap index, if necessary (call the function)
-    _mem_resize_gap_ix(pool_mgr);
+    if((*arena).num_records == 0 ||
+       alloc != _mem_arena_record(pool_mgr, (*arena).num_records - 1))
+    {// not the latest allocation, it goes with mem_pool_reset()
+        return ALLOC_FAIL;
+    }
 
-    // add the entry at the end
-    gap_pt new_gap = &(*pool_mgr).gap_ix[(*pool_mgr).pool.num_gaps];
-    (*new_gap).size = size;
-    (*new_gap).node = node;
+    // pop it, the offset goes back to where it started
+    (*arena).num_records--;
+    (*arena).offset -= (*alloc).size;
 
-    // update metadata (num_gaps)
-    (*pool_mgr).pool.num_gaps++;
+    // update metadata (num_allocs, alloc_size, the trailing gap)
+    (*pool_mgr).pool.num_allocs--;
+    (*pool_mgr).pool.alloc_size -= (*alloc).size;
+    (*pool_mgr).pool.num_gaps = 1;
 
-    // sort the gap index (call the function)
-    alloc_status status = _mem_sort_gap_ix(pool_mgr);
+    (*alloc).mem = NULL;
+    (*alloc).size = 0;
 
-    if(status == ALLOC_OK)
-    {// check success
-        return ALLOC_OK;
-    }
-    return ALLOC_FAIL;
-}//End _mem_add_to_gap_ix
+    return ALLOC_OK;
+}//End _mem_arena_free
 
-static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
-                                            size_t size,
-                                            node_pt node)
+static alloc_pt _mem_arena_record(pool_mgr_pt pool_mgr, unsigned index)
+{
+    return &(*(*pool_mgr).arena).chunks[index / MEM_ARENA_CHUNK_RECORDS]
+                                       [index % MEM_ARENA_CHUNK_RECORDS];
+}//End _mem_arena_record
+
+static void _mem_arena_rewind(pool_mgr_pt pool_mgr, size_t offset)
 {
-    int position = -1;
-    for(int parser = 0; parser < (*pool_mgr).gap_ix_capacity; parser++)
-    {// find the position of the node in the gap index
-        if((*pool_mgr).gap_ix[parser].node == node)
+    arena_pt arena = (*pool_mgr).arena;
+    char *mark_mem = (*pool_mgr).pool.mem + offset;
+
+    // binary search for the first record at or reaching past the mark
+    unsigned low = 0;
+    unsigned high = (*arena).num_records;
+    while(low < high)
+    {
+        unsigned mid = low + (high - low) / 2;
+        alloc_pt record = _mem_arena_record(pool_mgr, mid);
+        if((*record).mem >= mark_mem ||
+           (*record).mem + (*record).size > mark_mem)
         {
-            position = parser;
-            parser = (*pool_mgr).gap_ix_capacity;
+            high = mid;
+        }
+        else
+        {
+            low = mid + 1;
         }
-    }
-    if(position < 0)
-    {//didn't find the node in the gap index
-        return ALLOC_FAIL;
     }
 
-    for(int parser=position; parser < (*pool_mgr).gap_ix_capacity; parser++)
-    {// loop from there to the end of the array:
-        //    pull the entries (i.e. copy over) one position up
-        //    this effectively deletes the chosen node
-        (*pool_mgr).gap_ix[parser] = (*pool_mgr).gap_ix[parser + 1];
+    // drop it and the rest, the offset goes back to where it started
+    if(low < (*arena).num_records)
+    {
+        (*arena).offset = (size_t)
+                ((*_mem_arena_record(pool_mgr, low)).mem -
+                 (*pool_mgr).pool.mem);
+        (*arena).num_records = low;
     }
 
-    // update metadata (num_gaps)
-    (*pool_mgr).pool.num_gaps--;
+    // update metadata (the records are back to back from the start)
+    (*pool_mgr).pool.num_allocs = (*arena).num_records;
+    (*pool_mgr).pool.alloc_size = (*arena).offset;
+    (*pool_mgr).pool.num_gaps =
+            ((*arena).offset < (*pool_mgr).pool.total_size);
+}//End _mem_arena_rewind
 
-    // zero out the element at position num_gaps!
-    gap_pt to_delete = &(*pool_mgr).gap_ix[(*pool_mgr).pool.num_gaps];
-    (*to_delete).size = 0;
-    (*to_delete).node = NULL;
-    return ALLOC_OK;
-}//End _mem_remove_from_gap_ix
+static void _mem_arena_inspect(pool_mgr_pt pool_mgr,
+                               pool_segment_pt *segments,
+                               unsigned *num_segments)
+{
+    unsigned count = (*pool_mgr).pool.num_allocs + (*pool_mgr).pool.num_gaps;
 
-// note: only called by _mem_add_to_gap_ix, which appends a single entry
-static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr)
-{
-    // the new entry is at the end, so "bubble it up"
-    for(int parser = (*pool_mgr).pool.num_gaps - 1; parser > 0; parser--)
-    {// loop from num_gaps - 1 until but not including 0:
-        if((*pool_mgr).gap_ix[parser].size <
-           (*pool_mgr).gap_ix[parser - 1].size)
-        {//if the size of the current entry is less than the previous (u - 1)
-            //       swap them (by copying)
-            gap_t temp_gap_swapper = (*pool_mgr).gap_ix[parser];
-            (*pool_mgr).gap_ix[parser] = (*pool_mgr).gap_ix[parser - 1];
-            (*pool_mgr).gap_ix[parser - 1] = temp_gap_swapper;
-        }
-        else if((*pool_mgr).gap_ix[parser].size ==
-                (*pool_mgr).gap_ix[parser - 1].size)
-        {//    or if the sizes are the same
-            // a node with a lower address of pool allocation address (mem)
-            if((*(*pool_mgr).gap_ix[parser].node).alloc_record.mem <
-               (*(*pool_mgr).gap_ix[parser - 1].node).alloc_record.mem)
-            {//and the current entry points to a node with a lower address
-                // of pool allocation address (mem)
-                //       swap them (by copying)
-                gap_t temp_gap_swapper = (*pool_mgr).gap_ix[parser];
-                (*pool_mgr).gap_ix[parser] = (*pool_mgr).gap_ix[parser - 1];
-                (*pool_mgr).gap_ix[parser - 1] = temp_gap_swapper;
-            }
+    // allocate the segments array with size == allocs + gaps
+    pool_segment_pt segs = (pool_segment_pt)
+            calloc(count, sizeof(pool_segment_t));
 
-        }
+    if(segs == NULL)
+    {// check successful
+        return;
+    }
+
+    for(unsigned index = 0; index < (*pool_mgr).pool.num_allocs; index++)
+    {// one segment per record
+        segs[index].size = (*_mem_arena_record(pool_mgr, index)).size;
+        segs[index].allocated = 1;
     }
-    return ALLOC_OK;
-}//End _mem_sort_gap_ix
 
+    if((*pool_mgr).pool.num_gaps != 0)
+    {// the rest of the pool past the offset
+        segs[count - 1].size = (*pool_mgr).pool.total_size -
+                               (*(*pool_mgr).arena).offset;
+    }
 
+    // "return" the values:
+    *segments = segs;
+    *num_segments = count;
+}//End _mem_arena_inspect
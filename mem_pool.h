@@ -6,10 +6,11 @@
 #define DENVER_OS_PA_C_MEM_POOL_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 /* type declarations */
 
-typedef enum _alloc_policy { FIRST_FIT, BEST_FIT } alloc_policy;
+typedef enum _alloc_policy { FIRST_FIT, BEST_FIT, TLSF, BUDDY, FIXED, NEXT_FIT, ARENA } alloc_policy;
 
 typedef struct _pool {
     char *mem;
@@ -25,11 +26,35 @@ typedef struct _alloc {
     char *mem;
 } alloc_t, *alloc_pt;
 
+// node index (24 bits) + generation (8 bits), 0 is never valid; the
+// generation wraps, so a stale handle kept across 256 reuses of its node
+// validates again and aliases the newer allocation
+typedef uint32_t mem_alloc_handle_t;
+
+typedef size_t mem_pool_mark_t; // offset into the pool, see mem_pool_mark()
+
+typedef struct _mem_ctx mem_ctx_t, *mem_ctx_pt; // a pool store, opaque
+
 typedef struct _pool_segment {
     size_t size;
-    unsigned long allocated; // 1-allocation, 0-gap (note: 8 bytes)
+    unsigned long allocated; // 1-allocation, 0-gap, 2-cached (note: 8 bytes)
 } pool_segment_t, *pool_segment_pt;
 
+typedef struct _pool_stats {
+    unsigned total_nodes;        // node heap capacity
+    unsigned used_nodes;         // nodes in the segment list
+    unsigned long node_reuses;   // spare nodes taken off the unused list
+    unsigned long node_releases; // nodes returned to the unused list
+    unsigned quick_blocks;       // freed blocks waiting on the quick lists
+    unsigned long remote_frees;  // frees queued by other threads, then done
+} pool_stats_t, *pool_stats_pt;
+
+typedef struct _pool_compact {
+    size_t bytes_moved;          // bytes copied to a lower address
+    unsigned allocs_moved;       // allocations whose mem changed
+    unsigned long nanoseconds;   // time the call took
+} pool_compact_t, *pool_compact_pt;
+
 typedef enum _alloc_status {
     ALLOC_OK,
     ALLOC_FAIL,
@@ -48,16 +73,95 @@ mem_free();
 pool_pt
 mem_pool_open(size_t size, alloc_policy policy);
 
+pool_pt
+mem_pool_open_fixed(size_t obj_size, unsigned num_objs);
+
+pool_pt
+mem_pool_open_sharded(size_t size, alloc_policy policy, unsigned num_shards);
+
+mem_ctx_pt
+mem_ctx_create();
+
+alloc_status
+mem_ctx_destroy(mem_ctx_pt ctx);
+
+pool_pt
+mem_ctx_pool_open(mem_ctx_pt ctx, size_t size, alloc_policy policy);
+
+pool_pt
+mem_ctx_pool_open_fixed(mem_ctx_pt ctx, size_t obj_size, unsigned num_objs);
+
+pool_pt
+mem_ctx_pool_open_sharded(mem_ctx_pt ctx, size_t size, alloc_policy policy,
+                          unsigned num_shards);
+
 alloc_status
 mem_pool_close(pool_pt pool);
 
+alloc_status
+mem_pool_reset(pool_pt pool);
+
+alloc_status
+mem_pool_mark(pool_pt pool, mem_pool_mark_t *mark);
+
+alloc_status
+mem_pool_rewind(pool_pt pool, mem_pool_mark_t mark);
+
+alloc_status
+mem_pool_compact(pool_pt pool, pool_compact_pt report);
+
+// limits are checked between moves, a single move is never split and
+// can run past max_ns
+alloc_status
+mem_pool_compact_step(pool_pt pool,
+                      size_t max_bytes,
+                      unsigned long max_ns,
+                      pool_compact_pt report);
+
 alloc_pt
 mem_new_alloc(pool_pt pool, size_t size);
 
+alloc_status
+mem_new_alloc_batch(pool_pt pool, const size_t *sizes, unsigned num_allocs,
+                    alloc_pt *allocs);
+
 alloc_status
 mem_del_alloc(pool_pt pool, alloc_pt alloc);
 
+alloc_status
+mem_del_alloc_batch(pool_pt pool, alloc_pt *allocs, unsigned num_allocs);
+
+mem_alloc_handle_t
+mem_new_handle(pool_pt pool, size_t size);
+
+char *
+mem_handle_mem(pool_pt pool, mem_alloc_handle_t handle);
+
+alloc_status
+mem_del_handle(pool_pt pool, mem_alloc_handle_t handle);
+
 void
 mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments);
 
+alloc_status
+mem_pool_stats(pool_pt pool, pool_stats_pt stats);
+
+alloc_status
+mem_pool_snapshot(pool_pt pool, pool_pt snapshot);
+
+alloc_status
+mem_pool_set_quick_lists(pool_pt pool, size_t max_size);
+
+alloc_status
+mem_pool_flush_quick_lists(pool_pt pool);
+
+alloc_status
+mem_pool_set_thread_cache(pool_pt pool, unsigned enabled);
+
+alloc_status
+mem_thread_cache_flush(pool_pt pool);
+
+alloc_status
+mem_pool_set_remote_free(pool_pt pool, unsigned enabled);
+
 #endif //DENVER_OS_PA_C_MEM_POOL_H
@@ -12,6 +12,10 @@
 
 #include "cmocka.h"
 #include "mem_pool.h"
+
+#ifdef MEM_POOL_THREAD_SAFE
+#include <pthread.h>
+#endif
 #include "test_suite.h"
 
 
@@ -157,6 +161,88 @@ static void test_pool_store_smoketest(void **state) {
     }
 }
 
+static void test_pool_store_churn(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * 1. Open 100 pools, so the store grows.
+     * 2. Close every other one; the pools moved into their slots still
+     *    work and still close.
+     * 3. Open and close short-lived pools over and over.
+     * 4. The store is empty at the end.
+     */
+
+    const unsigned NUM_POOLS = 100;
+    pool_pt pools[100];
+    unsigned pix;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    for (pix = 0; pix < NUM_POOLS; ++pix) {
+        pools[pix] = mem_pool_open(1000, FIRST_FIT);
+        assert_non_null(pools[pix]);
+    }
+    for (pix = 0; pix < NUM_POOLS; pix += 2)
+        assert_int_equal(mem_pool_close(pools[pix]), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_FAIL);
+
+    for (pix = 1; pix < NUM_POOLS; pix += 2) {
+        alloc_pt alloc = mem_new_alloc(pools[pix], 100);
+        assert_non_null(alloc);
+        assert_int_equal(mem_del_alloc(pools[pix], alloc), ALLOC_OK);
+    }
+
+    for (unsigned round = 0; round < 1000; ++round) {
+        pool_pt pool = mem_pool_open(1000, BEST_FIT);
+        assert_non_null(pool);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    for (pix = 1; pix < NUM_POOLS; pix += 2)
+        assert_int_equal(mem_pool_close(pools[pix]), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_ctx_smoketest(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * 1. Two contexts have separate stores, and the default one is
+     *    untouched (mem_pool_open() still needs mem_init()).
+     * 2. A context with an open pool can't be destroyed.
+     * 3. mem_pool_close() closes a pool of any context.
+     * 4. MEM_POOL_SMALL builds refuse pools of 4 GiB or more.
+     */
+
+    mem_ctx_pt ctx_a = mem_ctx_create();
+    mem_ctx_pt ctx_b = mem_ctx_create();
+    assert_non_null(ctx_a);
+    assert_non_null(ctx_b);
+    assert_int_equal(mem_ctx_destroy(NULL), ALLOC_FAIL);
+
+    pool_pt pool_a = mem_ctx_pool_open(ctx_a, POOL_SIZE, FIRST_FIT);
+    pool_pt pool_b = mem_ctx_pool_open_fixed(ctx_b, 32, 100);
+    assert_non_null(pool_a);
+    assert_non_null(pool_b);
+    assert_null(mem_pool_open(POOL_SIZE, FIRST_FIT));
+#ifdef MEM_POOL_SMALL
+    assert_null(mem_ctx_pool_open(ctx_a, (size_t) UINT32_MAX + 1, FIRST_FIT));
+    assert_null(mem_ctx_pool_open_sharded(ctx_a, (size_t) UINT32_MAX + 1,
+                                          FIRST_FIT, 4));
+#endif
+
+    alloc_pt alloc = mem_new_alloc(pool_a, 100);
+    assert_non_null(alloc);
+    check_metadata(pool_a, FIRST_FIT, POOL_SIZE, 100, 1, 1);
+    assert_int_equal(mem_del_alloc(pool_a, alloc), ALLOC_OK);
+
+    assert_int_equal(mem_ctx_destroy(ctx_a), ALLOC_FAIL);
+    assert_int_equal(mem_pool_close(pool_a), ALLOC_OK);
+    assert_int_equal(mem_ctx_destroy(ctx_a), ALLOC_OK);
+
+    assert_int_equal(mem_pool_close(pool_b), ALLOC_OK);
+    assert_int_equal(mem_ctx_destroy(ctx_b), ALLOC_OK);
+}
+
 static void test_pool_smoketest(void **state) {
     (void) state; /* unused */
 
@@ -468,6 +554,253 @@ static void test_pool_bf_metadata(void **state) {
 }
 
 
+static void test_pool_node_stats(void **state) {
+    pool_pt pool = *state;
+    pool_stats_t stats;
+
+    /*
+     * Node heap churn:
+     *
+     * 1. Allocate 100, 200. Three nodes, none reused.
+     * 2. Deallocate the 200. Its gap merges, releasing a node.
+     * 3. Allocate 50. The split reuses the released node.
+     * 4. Clean up.
+     */
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc1);
+
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.used_nodes, 3);
+    assert_int_equal(stats.node_reuses, 0);
+    assert_int_equal(stats.node_releases, 0);
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.used_nodes, 2);
+    assert_int_equal(stats.node_reuses, 0);
+    assert_int_equal(stats.node_releases, 1);
+
+
+    alloc_pt alloc2 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc2);
+
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.used_nodes, 3);
+    assert_int_equal(stats.node_reuses, 1);
+    assert_int_equal(stats.node_releases, 1);
+    assert_true(stats.total_nodes >= stats.used_nodes);
+
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+static void test_pool_handles(void **state) {
+    pool_pt pool = *state;
+    const unsigned num_handles = 200;
+    mem_alloc_handle_t handles[num_handles];
+
+    /*
+     * Handles:
+     *
+     * 1. Allocate 200 x 100 through handles. The node heap grows
+     *    under them, every handle still resolves to its memory.
+     * 2. Delete the first one. Its handle goes stale and cannot
+     *    be deleted again.
+     * 3. Allocate 100. It reuses the first node and memory, but
+     *    the new handle differs and the stale one stays stale.
+     * 4. Delete and reallocate the first one 255 more times. The 8-bit
+     *    generation wraps, and the stale handle aliases the new one.
+     * 5. Clean up.
+     */
+
+    for (unsigned hix = 0; hix < num_handles; ++hix) {
+        handles[hix] = mem_new_handle(pool, 100);
+        assert_int_not_equal(handles[hix], 0);
+    }
+    for (unsigned hix = 0; hix < num_handles; ++hix) {
+        assert_ptr_equal(mem_handle_mem(pool, handles[hix]),
+                         (*pool).mem + hix * 100);
+    }
+
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 100 * num_handles, num_handles, 1);
+
+
+    mem_alloc_handle_t stale = handles[0];
+    assert_int_equal(mem_del_handle(pool, stale), ALLOC_OK);
+    assert_null(mem_handle_mem(pool, stale));
+    assert_int_equal(mem_del_handle(pool, stale), ALLOC_FAIL);
+
+
+    handles[0] = mem_new_handle(pool, 100);
+    assert_int_not_equal(handles[0], 0);
+    assert_int_not_equal(handles[0], stale);
+    assert_ptr_equal(mem_handle_mem(pool, handles[0]), (*pool).mem);
+    assert_null(mem_handle_mem(pool, stale));
+
+
+    for (unsigned reuse = 1; reuse < 255; ++reuse) {
+        assert_int_equal(mem_del_handle(pool, handles[0]), ALLOC_OK);
+        handles[0] = mem_new_handle(pool, 100);
+        assert_int_not_equal(handles[0], stale);
+    }
+    assert_int_equal(mem_del_handle(pool, handles[0]), ALLOC_OK);
+    handles[0] = mem_new_handle(pool, 100);
+    assert_int_equal(handles[0], stale);
+    assert_ptr_equal(mem_handle_mem(pool, stale), (*pool).mem);
+
+
+    // clean up
+    for (unsigned hix = 0; hix < num_handles; ++hix) {
+        assert_int_equal(mem_del_handle(pool, handles[hix]), ALLOC_OK);
+    }
+
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+static void test_pool_quick_lists(void **state) {
+    pool_pt pool = *state;
+    pool_stats_t stats;
+
+    /*
+     * Quick lists (cached blocks show as 2 in the segments):
+     *
+     * 1. Cache sizes up to 128. Allocate 100, 64, 100.
+     * 2. Deallocate the 64. It is cached, not merged.
+     * 3. Allocate 64. It gets the cached block back.
+     * 4. Deallocate the 64 and the first 100. Both are cached.
+     * 5. Flush. The two blocks merge into one gap.
+     * 6. Deallocate the last 100. It is cached, and the pool is
+     *    closed (teardown) with it still on its list.
+     */
+
+    assert_int_equal(mem_pool_set_quick_lists(pool, 128), ALLOC_OK);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 64);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc2);
+
+
+    char *mem1 = alloc1->mem;
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    pool_segment_t exp0[4] =
+            {
+                    {100, 1},
+                    {64, 2},
+                    {100, 1},
+                    {pool->total_size - 264, 0},
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 200, 2, 1);
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.quick_blocks, 1);
+
+
+    alloc1 = mem_new_alloc(pool, 64);
+    assert_non_null(alloc1);
+    assert_ptr_equal(alloc1->mem, mem1);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 264, 3, 1);
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    pool_segment_t exp1[4] =
+            {
+                    {100, 2},
+                    {64, 2},
+                    {100, 1},
+                    {pool->total_size - 264, 0},
+            };
+    check_pool(pool, exp1);
+
+
+    assert_int_equal(mem_pool_flush_quick_lists(pool), ALLOC_OK);
+    pool_segment_t exp2[3] =
+            {
+                    {164, 0},
+                    {100, 1},
+                    {pool->total_size - 264, 0},
+            };
+    check_pool(pool, exp2);
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.quick_blocks, 0);
+
+
+    // leave the last one cached, closing the pool flushes it
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 2);
+}
+
+static void test_pool_sharded(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * 1. A pool in 4 shards starts as 4 gaps, one per shard.
+     * 2. Allocating a whole shard 4 times falls back from shard to shard.
+     * 3. Nothing fits after that.
+     * 4. Sharded pools have no handles, and don't close while in use.
+     * 5. Freeing everything gives back the 4 gaps.
+     */
+
+    const unsigned NUM_SHARDS = 4;
+    const size_t SHARD_SIZE = POOL_SIZE / NUM_SHARDS;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    assert_null(mem_pool_open_sharded(POOL_SIZE, FIXED, NUM_SHARDS));
+    assert_null(mem_pool_open_sharded(POOL_SIZE, FIRST_FIT, 0));
+
+    pool_pt pool = mem_pool_open_sharded(POOL_SIZE, FIRST_FIT, NUM_SHARDS);
+    assert_non_null(pool);
+
+    pool_segment_t exp0[4] =
+            {
+                    {SHARD_SIZE, 0},
+                    {SHARD_SIZE, 0},
+                    {SHARD_SIZE, 0},
+                    {SHARD_SIZE, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 4);
+
+    alloc_pt allocs[4];
+    unsigned aix;
+    for (aix = 0; aix < NUM_SHARDS; ++aix) {
+        allocs[aix] = mem_new_alloc(pool, SHARD_SIZE);
+        assert_non_null(allocs[aix]);
+        assert_true(allocs[aix]->mem >= pool->mem &&
+                    allocs[aix]->mem < pool->mem + POOL_SIZE);
+    }
+    assert_null(mem_new_alloc(pool, 1));
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, POOL_SIZE, 4, 0);
+
+    assert_int_equal(mem_new_handle(pool, 1), 0);
+    assert_int_equal(mem_pool_close(pool), ALLOC_NOT_FREED);
+
+    for (aix = 0; aix < NUM_SHARDS; ++aix)
+        assert_int_equal(mem_del_alloc(pool, allocs[aix]), ALLOC_OK);
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 4);
+
+    pool_t snapshot;
+    assert_int_equal(mem_pool_snapshot(pool, &snapshot), ALLOC_OK);
+    assert_int_equal(snapshot.num_gaps, 4);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
 /*******************************************/
 /***       3. FIRST_FIT SCENARIOS        ***/
 /*******************************************/
@@ -1537,56 +1870,89 @@ static void test_pool_scenario10(void **state) {
     check_pool(pool, exp0);
 }
 
-/*******************************************/
-/***        4. BEST_FIT SCENARIOS        ***/
-/*******************************************/
+static void test_pool_scenario21(void **state) {
+    pool_pt pool = *state;
 
-static int pool_bf_setup(void **state) {
-    alloc_status status;
-    const alloc_policy POOL_POLICY = BEST_FIT;
-    pool_pt pool = NULL;
+    /*
+     * Scenario 21:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 4 x 100.
+     * 3. Deallocate 1, 3. The 3rd merges with the rest of the pool.
+     * 4. Allocate 50. Goes in the gap of 1, leaving a 50 gap behind it.
+     * 5. Allocate 20. Goes in the 50 gap, the lowest address that fits.
+     * 6. Clean up.
+     */
 
-    status = mem_init();
-    assert_int_equal(status, ALLOC_OK);
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0}
+            };
+    check_pool(pool, exp0);
 
-    INFO("Allocating pool of %lu bytes with policy %s\n",
-         (long) POOL_SIZE, (POOL_POLICY == FIRST_FIT) ? "FIRST_FIT" : "BEST_FIT");
-    pool = mem_pool_open(POOL_SIZE, POOL_POLICY);
-    assert_non_null(pool);
 
-    *state = pool;
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc2);
+    alloc_pt alloc3 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc3);
 
-    return 0;
-}
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
 
-static int pool_bf_teardown(void **state) {
-    pool_pt pool = *state;
-    alloc_status status;
+    pool_segment_t exp1[4] =
+            {
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {pool->total_size - 300, 0}
+            };
+    check_pool(pool, exp1);
 
-    INFO("Closing pool\n");
-    status = mem_pool_close(pool);
-    assert_int_equal(status, ALLOC_OK);
 
-    status = mem_free();
-    assert_int_equal(status, ALLOC_OK);
+    alloc_pt alloc4 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc4);
+    alloc_pt alloc5 = mem_new_alloc(pool, 20);
+    assert_non_null(alloc5);
 
-    return 0;
-}
+    pool_segment_t exp2[6] =
+            {
+                    {100, 1},
+                    {50, 1},
+                    {20, 1},
+                    {30, 0},
+                    {100, 1},
+                    {pool->total_size - 300, 0}
+            };
+    check_pool(pool, exp2);
 
-static void dummy_test(void **state) {
-    (void) state;
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc5), ALLOC_OK);
+
+    check_pool(pool, exp0);
 }
 
-static void test_pool_scenario11(void **state) {
-    alloc_status status;
+static void test_pool_scenario30(void **state) {
     pool_pt pool = *state;
 
     /*
-     * Scenario 11:
+     * Scenario 30:
      *
      * 1. Pool starts out as a single gap.
-     * 2. Allocate 100. That will be at the top. The rest is a gap.
-     * 3. Deallocate the 100 allocation. Pool is again one single gap.
+     * 2. Allocate a batch of 100, 200, 300. Carved back to back.
+     * 3. Allocate 400000, 100, 400000 and deallocate both 400000s.
+     * 4. Allocate a batch of 300000, 300000. No one gap holds both, so
+     *    they go one at a time, first fit.
+     * 5. Allocate a batch of 10, 500000. 500000 fits nowhere, so the
+     *    batch fails and the pool is unchanged.
+     * 6. Clean up.
      */
 
     pool_segment_t exp0[1] =
@@ -1596,378 +1962,611 @@ static void test_pool_scenario11(void **state) {
     check_pool(pool, exp0);
 
 
-    alloc_pt alloc0 = mem_new_alloc(pool, 100);
-    assert_non_null(alloc0);
+    const size_t sizes0[3] = {100, 200, 300};
+    alloc_pt batch0[3];
+    assert_int_equal(mem_new_alloc_batch(pool, sizes0, 3, batch0), ALLOC_OK);
+    assert_ptr_equal(batch0[1]->mem, batch0[0]->mem + 100);
+    assert_ptr_equal(batch0[2]->mem, batch0[1]->mem + 200);
 
-    pool_segment_t exp1[2] =
+    pool_segment_t exp1[4] =
             {
                     {100, 1},
-                    {pool->total_size-100, 0}
+                    {200, 1},
+                    {300, 1},
+                    {pool->total_size - 600, 0}
             };
     check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, pool->total_size, 600, 3, 1);
 
 
-    status = mem_del_alloc(pool, alloc0);
-    assert_int_equal(status, ALLOC_OK);
+    alloc_pt alloc0 = mem_new_alloc(pool, 400000);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 400000);
+    assert_non_null(alloc2);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+    const size_t sizes1[2] = {300000, 300000};
+    alloc_pt batch1[2];
+    assert_int_equal(mem_new_alloc_batch(pool, sizes1, 2, batch1), ALLOC_OK);
+
+    pool_segment_t exp2[8] =
+            {
+                    {100, 1},
+                    {200, 1},
+                    {300, 1},
+                    {300000, 1},
+                    {100000, 0},
+                    {100, 1},
+                    {300000, 1},
+                    {pool->total_size - 700700, 0}
+            };
+    check_pool(pool, exp2);
+    check_metadata(pool, FIRST_FIT, pool->total_size, 600700, 6, 2);
+
+
+    const size_t sizes2[2] = {10, 500000};
+    alloc_pt batch2[2];
+    assert_int_equal(mem_new_alloc_batch(pool, sizes2, 2, batch2), ALLOC_FAIL);
+    check_pool(pool, exp2);
+    check_metadata(pool, FIRST_FIT, pool->total_size, 600700, 6, 2);
+
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, batch0[0]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, batch0[1]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, batch0[2]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, batch1[0]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, batch1[1]), ALLOC_OK);
 
     check_pool(pool, exp0);
 }
 
-static void test_pool_scenario12(void **state) {
-    alloc_status status;
+static void test_pool_scenario31(void **state) {
     pool_pt pool = *state;
 
     /*
-     * Scenario 12:
+     * Scenario 31:
      *
      * 1. Pool starts out as a single gap.
-     * 2. Allocate 10 x 100.
-     * 3. Deallocate (1, 2), 4, (6, 7, 8)
-     * 4. Allocate 100.
-     * 5. Clean up.
+     * 2. Allocate 6 x 100 and deallocate the 2nd.
+     * 3. Deallocate the 5th, 3rd, 1st and 4th as a batch, out of order.
+     *    They merge with the gap between them into one gap.
+     * 4. Deallocate the 6th as a batch of one. Pool is a single gap.
+     * 5. Allocate 100 x 16 and deallocate them as a batch, in reverse.
+     *    Pool is a single gap.
      */
 
     pool_segment_t exp0[1] =
             {
-                    {pool->total_size, 0},
+                    {pool->total_size, 0}
             };
     check_pool(pool, exp0);
+    assert_int_equal(mem_del_alloc_batch(pool, NULL, 0), ALLOC_OK);
 
 
-    const unsigned NUM_ALLOCS = 10;
+    alloc_pt allocs0[6];
+    for (unsigned i = 0; i < 6; ++i) {
+        allocs0[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs0[i]);
+    }
+    assert_int_equal(mem_del_alloc(pool, allocs0[1]), ALLOC_OK);
 
-    alloc_pt *allocs = (alloc_pt *) calloc(NUM_ALLOCS, sizeof(alloc_pt));
-    assert_non_null(allocs);
+    alloc_pt batch0[4] = {allocs0[4], allocs0[2], allocs0[0], allocs0[3]};
+    assert_int_equal(mem_del_alloc_batch(pool, batch0, 4), ALLOC_OK);
 
-    int i;
-    for (i=0; i<NUM_ALLOCS; ++i) {
-        allocs[i] = mem_new_alloc(pool, 100);
-        assert_non_null(allocs[i]);
-    }
-    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK); allocs[2]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK); allocs[4]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK); allocs[8]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK); allocs[7]=0;
-
-    pool_segment_t exp1[8] =
+    pool_segment_t exp1[3] =
             {
+                    {500, 0},
                     {100, 1},
-                    {200, 0},
-                    {100, 1},
-                    {100, 0},
-                    {100, 1},
-                    {300, 0},
-                    {100, 1},
-                    {pool->total_size - 1000, 0},
+                    {pool->total_size - 600, 0}
             };
     check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, pool->total_size, 100, 1, 2);
 
 
-    alloc_pt alloc0 = mem_new_alloc(pool, 100);
-    assert_non_null(alloc0);
-    pool_segment_t exp2[8] =
-            {
-                    {100, 1},
-                    {200, 0},
-                    {100, 1},
-                    {100, 1},
-                    {100, 1},
-                    {300, 0},
-                    {100, 1},
-                    {pool->total_size - 1000, 0},
-            };
-    check_pool(pool, exp2);
+    assert_int_equal(mem_del_alloc_batch(pool, &allocs0[5], 1), ALLOC_OK);
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, pool->total_size, 0, 0, 1);
 
 
-    // clean up
-    for (i=0; i<NUM_ALLOCS; ++i) {
-        if (allocs[i])
-            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    alloc_pt allocs1[100];
+    alloc_pt batch1[100];
+    for (unsigned i = 0; i < 100; ++i) {
+        allocs1[i] = mem_new_alloc(pool, 16);
+        assert_non_null(allocs1[i]);
+        batch1[99 - i] = allocs1[i];
     }
-    free(allocs);
-    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc_batch(pool, batch1, 100), ALLOC_OK);
 
-    
     check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, pool->total_size, 0, 0, 1);
 }
 
-static void test_pool_scenario13(void **state) {
-    alloc_status status;
+static void test_pool_scenario33(void **state) {
     pool_pt pool = *state;
 
     /*
-     * Scenario 13:
+     * Scenario 33:
      *
      * 1. Pool starts out as a single gap.
-     * 2. Allocate 10 x 100.
-     * 3. Deallocate 1, 4, (6, 7, 8)
-     * 4. Allocate 100.
-     * 5. Clean up.
+     * 2. Allocate 100, 200. Mark (at 300).
+     * 3. Allocate 300, 400. Mark again (at 1000). Allocate 500.
+     * 4. Rewind to the second mark. The 500 is gone.
+     * 5. Deallocate the 400. Allocate 50 and a handle of 10, both at
+     *    the tail gap. Rewind to the first mark. Everything after the
+     *    200 is one gap and the handle is stale.
+     * 6. Reset. Pool is a single gap.
      */
 
     pool_segment_t exp0[1] =
             {
-                    {pool->total_size, 0},
+                    {pool->total_size, 0}
             };
     check_pool(pool, exp0);
 
 
-    const unsigned NUM_ALLOCS = 10;
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc1);
+    mem_pool_mark_t mark0;
+    assert_int_equal(mem_pool_mark(pool, &mark0), ALLOC_OK);
+    assert_int_equal(mark0, 300);
 
-    alloc_pt *allocs = (alloc_pt *) calloc(NUM_ALLOCS, sizeof(alloc_pt));
-    assert_non_null(allocs);
 
-    int i;
-    for (i=0; i<NUM_ALLOCS; ++i) {
-        allocs[i] = mem_new_alloc(pool, 100);
-        assert_non_null(allocs[i]);
-    }
-    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK); allocs[4]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK); allocs[8]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK); allocs[7]=0;
+    alloc_pt alloc2 = mem_new_alloc(pool, 300);
+    assert_non_null(alloc2);
+    alloc_pt alloc3 = mem_new_alloc(pool, 400);
+    assert_non_null(alloc3);
+    mem_pool_mark_t mark1;
+    assert_int_equal(mem_pool_mark(pool, &mark1), ALLOC_OK);
+    assert_int_equal(mark1, 1000);
+    assert_non_null(mem_new_alloc(pool, 500));
 
-    pool_segment_t exp1[9] =
+
+    assert_int_equal(mem_pool_rewind(pool, mark1), ALLOC_OK);
+
+    pool_segment_t exp1[5] =
             {
                     {100, 1},
-                    {100, 0},
-                    {100, 1},
-                    {100, 1},
-                    {100, 0},
-                    {100, 1},
-                    {300, 0},
-                    {100, 1},
-                    {pool->total_size - 1000, 0},
+                    {200, 1},
+                    {300, 1},
+                    {400, 1},
+                    {pool->total_size - 1000, 0}
             };
     check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, pool->total_size, 1000, 4, 1);
 
 
-    alloc_pt alloc0 = mem_new_alloc(pool, 100);
-    assert_non_null(alloc0);
-    pool_segment_t exp2[9] =
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    assert_non_null(mem_new_alloc(pool, 50));
+    mem_alloc_handle_t handle0 = mem_new_handle(pool, 10);
+    assert_int_not_equal(handle0, 0);
+    assert_int_equal(mem_pool_rewind(pool, mark0), ALLOC_OK);
+    assert_null(mem_handle_mem(pool, handle0));
+
+    pool_segment_t exp2[3] =
             {
                     {100, 1},
-                    {100, 1},
-                    {100, 1},
-                    {100, 1},
-                    {100, 0},
-                    {100, 1},
-                    {300, 0},
-                    {100, 1},
-                    {pool->total_size - 1000, 0},
+                    {200, 1},
+                    {pool->total_size - 300, 0}
             };
     check_pool(pool, exp2);
+    check_metadata(pool, FIRST_FIT, pool->total_size, 300, 2, 1);
 
 
-    // clean up
-    for (i=0; i<NUM_ALLOCS; ++i) {
-        if (allocs[i])
-            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
-    }
-    free(allocs);
-    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
-
-
+    assert_int_equal(mem_pool_reset(pool), ALLOC_OK);
     check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, pool->total_size, 0, 0, 1);
 }
 
-static void test_pool_scenario14(void **state) {
-    alloc_status status;
+static void test_pool_scenario35(void **state) {
     pool_pt pool = *state;
+    pool_compact_t report;
 
     /*
-     * Scenario 14:
+     * Scenario 35:
      *
      * 1. Pool starts out as a single gap.
-     * 2. Allocate 10 x 100.
-     * 3. Deallocate 4, 1, (6, 7, 8) (note: 4 before 1)
-     * 4. Allocate 100.
-     * 5. Clean up.
+     * 2. Allocate 100, 200, 300, a handle of 400, and 500, each with
+     *    its own first byte.
+     * 3. Deallocate the 100 and the 300.
+     * 4. Compact. The 200, 400 and 500 slide down, keeping their bytes,
+     *    and the handle follows its block. One gap is left at the end.
+     * 5. Compact again. Nothing moves.
+     * 6. Allocate the rest of the pool. Deallocate everything.
      */
 
-    pool_segment_t exp0[1] =
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 300);
+    assert_non_null(alloc2);
+    mem_alloc_handle_t handle0 = mem_new_handle(pool, 400);
+    assert_int_not_equal(handle0, 0);
+    alloc_pt alloc3 = mem_new_alloc(pool, 500);
+    assert_non_null(alloc3);
+    alloc1->mem[0] = 'a';
+    mem_handle_mem(pool, handle0)[0] = 'b';
+    alloc3->mem[0] = 'c';
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    pool_segment_t exp0[6] =
             {
-                    {pool->total_size, 0},
+                    {100, 0},
+                    {200, 1},
+                    {300, 0},
+                    {400, 1},
+                    {500, 1},
+                    {pool->total_size - 1500, 0}
             };
     check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, pool->total_size, 1100, 3, 3);
 
 
-    const unsigned NUM_ALLOCS = 10;
-
-    alloc_pt *allocs = (alloc_pt *) calloc(NUM_ALLOCS, sizeof(alloc_pt));
-    assert_non_null(allocs);
-
-    int i;
-    for (i=0; i<NUM_ALLOCS; ++i) {
-        allocs[i] = mem_new_alloc(pool, 100);
-        assert_non_null(allocs[i]);
-    }
-    assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK); allocs[4]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK); allocs[8]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK); allocs[7]=0;
+    assert_int_equal(mem_pool_compact(pool, &report), ALLOC_OK);
+    assert_int_equal(report.bytes_moved, 1100);
+    assert_int_equal(report.allocs_moved, 3);
 
-    pool_segment_t exp1[9] =
+    pool_segment_t exp1[4] =
             {
-                    {100, 1},
-                    {100, 0},
-                    {100, 1},
-                    {100, 1},
-                    {100, 0},
-                    {100, 1},
-                    {300, 0},
-                    {100, 1},
-                    {pool->total_size - 1000, 0},
+                    {200, 1},
+                    {400, 1},
+                    {500, 1},
+                    {pool->total_size - 1100, 0}
             };
     check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, pool->total_size, 1100, 3, 1);
+    assert_ptr_equal(alloc1->mem, pool->mem);
+    assert_ptr_equal(mem_handle_mem(pool, handle0), pool->mem + 200);
+    assert_ptr_equal(alloc3->mem, pool->mem + 600);
+    assert_int_equal(alloc1->mem[0], 'a');
+    assert_int_equal(mem_handle_mem(pool, handle0)[0], 'b');
+    assert_int_equal(alloc3->mem[0], 'c');
+
+
+    assert_int_equal(mem_pool_compact(pool, &report), ALLOC_OK);
+    assert_int_equal(report.bytes_moved, 0);
+    assert_int_equal(report.allocs_moved, 0);
+    check_pool(pool, exp1);
 
 
-    alloc_pt alloc0 = mem_new_alloc(pool, 100);
-    assert_non_null(alloc0);
-    pool_segment_t exp2[9] =
-            {
-                    {100, 1},
-                    {100, 1},
-                    {100, 1},
-                    {100, 1},
-                    {100, 0},
-                    {100, 1},
-                    {300, 0},
-                    {100, 1},
-                    {pool->total_size - 1000, 0},
-            };
-    check_pool(pool, exp2);
+    alloc_pt alloc4 = mem_new_alloc(pool, pool->total_size - 1100);
+    assert_non_null(alloc4);
+    check_metadata(pool, FIRST_FIT, pool->total_size, pool->total_size, 4, 0);
 
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_handle(pool, handle0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, pool->total_size, 0, 0, 1);
+}
 
-    // clean up
-    for (i=0; i<NUM_ALLOCS; ++i) {
-        if (allocs[i])
-            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+static void test_pool_scenario37(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Scenario 37 (a pool of 1000 bytes, quick lists up to 64):
+     *
+     * 1. Allocate 100 x 10 and deallocate them. They are all cached,
+     *    there are no gaps.
+     * 2. Allocate 500. The quick lists are flushed and it fits.
+     */
+
+    const size_t SMALL_POOL_SIZE = 1000;
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(SMALL_POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_set_quick_lists(pool, 64), ALLOC_OK);
+
+    alloc_pt allocs[100];
+    for (unsigned i = 0; i < 100; ++i) {
+        allocs[i] = mem_new_alloc(pool, 10);
+        assert_non_null(allocs[i]);
     }
-    free(allocs);
-    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    for (unsigned i = 0; i < 100; ++i) {
+        assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    check_metadata(pool, FIRST_FIT, SMALL_POOL_SIZE, 0, 0, 0);
+
 
+    alloc_pt alloc0 = mem_new_alloc(pool, 500);
+    assert_non_null(alloc0);
 
+    pool_segment_t exp0[2] =
+            {
+                    {500, 1},
+                    {500, 0}
+            };
     check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, SMALL_POOL_SIZE, 500, 1, 1);
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
 }
 
-static void test_pool_scenario15(void **state) {
-    alloc_status status;
+static void test_pool_scenario36(void **state) {
     pool_pt pool = *state;
+    pool_compact_t report;
 
     /*
-     * Scenario 15:
+     * Scenario 36:
      *
-     * 1. Pool starts out as a single gap.
-     * 2. Allocate 10 x 100.
-     * 3. Deallocate (1, 2), 4, (6, 7, 8)
-     * 4. Allocate 50.
-     * 5. Allocate another 50.
-     * 6. Clean up.
+     * 1. Allocate 100, 200, 300, a handle of 400, and 50, each with its
+     *    own first byte. Deallocate the 100 and the 300.
+     * 2. Step (1 byte). The largest gap with something after it is the
+     *    300. The last allocation, the 50, fits in it and moves there.
+     * 3. Step (1 byte). The 400 doesn't fit in what is left of the gap,
+     *    so the gap slides up past it and joins the tail gap.
+     * 4. Step with no limits. The 100 gap slides up past the 200, the 50
+     *    and the 400, and joins the tail gap.
+     * 5. Step again. Nothing moves.
+     * 6. Turn on the quick lists and deallocate the 50, which is cached.
+     *    Step with no limits. The 50 is flushed into a gap first, not
+     *    moved as if live, and the gap slides up past the 400.
      */
 
-    pool_segment_t exp0[1] =
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 300);
+    assert_non_null(alloc2);
+    mem_alloc_handle_t handle0 = mem_new_handle(pool, 400);
+    assert_int_not_equal(handle0, 0);
+    alloc_pt alloc3 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc3);
+    alloc1->mem[0] = 'a';
+    mem_handle_mem(pool, handle0)[0] = 'b';
+    alloc3->mem[0] = 'c';
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+
+    assert_int_equal(mem_pool_compact_step(pool, 1, 0, &report), ALLOC_OK);
+    assert_int_equal(report.bytes_moved, 50);
+    assert_int_equal(report.allocs_moved, 1);
+
+    pool_segment_t exp0[6] =
             {
-                    {pool->total_size, 0},
+                    {100, 0},
+                    {200, 1},
+                    {50, 1},
+                    {250, 0},
+                    {400, 1},
+                    {pool->total_size - 1000, 0}
             };
     check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, pool->total_size, 650, 3, 3);
+    assert_ptr_equal(alloc3->mem, pool->mem + 300);
+    assert_int_equal(alloc3->mem[0], 'c');
 
 
-    const unsigned NUM_ALLOCS = 10;
-
-    alloc_pt *allocs = (alloc_pt *) calloc(NUM_ALLOCS, sizeof(alloc_pt));
-    assert_non_null(allocs);
-
-    int i;
-    for (i=0; i<NUM_ALLOCS; ++i) {
-        allocs[i] = mem_new_alloc(pool, 100);
-        assert_non_null(allocs[i]);
-    }
-    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK); allocs[2]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK); allocs[4]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK); allocs[8]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK); allocs[7]=0;
+    assert_int_equal(mem_pool_compact_step(pool, 1, 0, &report), ALLOC_OK);
+    assert_int_equal(report.bytes_moved, 400);
+    assert_int_equal(report.allocs_moved, 1);
 
-    pool_segment_t exp1[8] =
+    pool_segment_t exp1[5] =
             {
-                    {100, 1},
-                    {200, 0},
-                    {100, 1},
                     {100, 0},
-                    {100, 1},
-                    {300, 0},
-                    {100, 1},
-                    {pool->total_size - 1000, 0},
+                    {200, 1},
+                    {50, 1},
+                    {400, 1},
+                    {pool->total_size - 750, 0}
             };
     check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, pool->total_size, 650, 3, 2);
+    assert_ptr_equal(mem_handle_mem(pool, handle0), pool->mem + 350);
+    assert_int_equal(mem_handle_mem(pool, handle0)[0], 'b');
 
 
-    alloc_pt alloc0 = mem_new_alloc(pool, 50);
-    assert_non_null(alloc0);
-    pool_segment_t exp2[9] =
+    assert_int_equal(mem_pool_compact_step(pool, 0, 0, &report), ALLOC_OK);
+    assert_int_equal(report.bytes_moved, 650);
+    assert_int_equal(report.allocs_moved, 3);
+
+    pool_segment_t exp2[4] =
             {
-                    {100, 1},
-                    {200, 0},
-                    {100, 1},
+                    {200, 1},
                     {50, 1},
-                    {50, 0},
-                    {100, 1},
-                    {300, 0},
-                    {100, 1},
-                    {pool->total_size - 1000, 0},
+                    {400, 1},
+                    {pool->total_size - 650, 0}
             };
     check_pool(pool, exp2);
+    check_metadata(pool, FIRST_FIT, pool->total_size, 650, 3, 1);
+    assert_int_equal(alloc1->mem[0], 'a');
+    assert_int_equal(mem_handle_mem(pool, handle0)[0], 'b');
+    assert_int_equal(alloc3->mem[0], 'c');
 
 
-    alloc_pt alloc1 = mem_new_alloc(pool, 50);
-    assert_non_null(alloc1);
-    pool_segment_t exp3[9] =
+    assert_int_equal(mem_pool_compact_step(pool, 0, 0, &report), ALLOC_OK);
+    assert_int_equal(report.bytes_moved, 0);
+    check_pool(pool, exp2);
+
+
+    assert_int_equal(mem_pool_set_quick_lists(pool, 64), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    assert_int_equal(mem_pool_compact_step(pool, 0, 0, &report), ALLOC_OK);
+    assert_int_equal(report.bytes_moved, 400);
+    assert_int_equal(report.allocs_moved, 1);
+
+    pool_segment_t exp3[3] =
             {
-                    {100, 1},
-                    {200, 0},
-                    {100, 1},
-                    {50, 1},
-                    {50, 1},
-                    {100, 1},
-                    {300, 0},
-                    {100, 1},
-                    {pool->total_size - 1000, 0},
+                    {200, 1},
+                    {400, 1},
+                    {pool->total_size - 600, 0}
             };
     check_pool(pool, exp3);
+    check_metadata(pool, FIRST_FIT, pool->total_size, 600, 2, 1);
+    assert_int_equal(alloc1->mem[0], 'a');
+    assert_int_equal(mem_handle_mem(pool, handle0)[0], 'b');
+
+
+    assert_int_equal(mem_pool_set_quick_lists(pool, 0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_handle(pool, handle0), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, pool->total_size, 0, 0, 1);
+}
+
+static void test_pool_scenario39(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 39:
+     *
+     * 1. Allocate 10, three times 0, and 10.
+     * 2. Deallocate the first and the last 0. The two 0-byte gaps have
+     *    the same offset.
+     * 3. Allocate 0 twice. Each takes one of the two gaps.
+     * 4. Deallocate the middle 0 and the last 10. The 0-byte gap and
+     *    the top gap start at the same offset.
+     * 5. Allocate 0. It takes the 0-byte gap, the top gap stays whole.
+     * 6. Clean up.
+     */
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 10);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 0);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 0);
+    assert_non_null(alloc2);
+    alloc_pt alloc3 = mem_new_alloc(pool, 0);
+    assert_non_null(alloc3);
+    alloc_pt alloc4 = mem_new_alloc(pool, 10);
+    assert_non_null(alloc4);
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 20, 3, 3);
+
+
+    alloc_pt alloc5 = mem_new_alloc(pool, 0);
+    assert_non_null(alloc5);
+    alloc_pt alloc6 = mem_new_alloc(pool, 0);
+    assert_non_null(alloc6);
+    assert_ptr_not_equal(alloc5, alloc6);
+    assert_ptr_equal(alloc5->mem, pool->mem + 10);
+    assert_ptr_equal(alloc6->mem, pool->mem + 10);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 20, 5, 1);
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 10, 3, 2);
+
+    alloc_pt alloc7 = mem_new_alloc(pool, 0);
+    assert_non_null(alloc7);
+    assert_ptr_equal(alloc7->mem, pool->mem + 10);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 10, 4, 1);
 
 
     // clean up
-    for (i=0; i<NUM_ALLOCS; ++i) {
-        if (allocs[i])
-            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
-    }
-    free(allocs);
     assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
-    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc5), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc6), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc7), ALLOC_OK);
+
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+/*******************************************/
+/***        4. BEST_FIT SCENARIOS        ***/
+/*******************************************/
+
+static int pool_bf_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = BEST_FIT;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes with policy %s\n",
+         (long) POOL_SIZE, (POOL_POLICY == FIRST_FIT) ? "FIRST_FIT" : "BEST_FIT");
+    pool = mem_pool_open(POOL_SIZE, POOL_POLICY);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static int pool_bf_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void dummy_test(void **state) {
+    (void) state;
+}
+
+static void test_pool_scenario11(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 11:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 100. That will be at the top. The rest is a gap.
+     * 3. Deallocate the 100 allocation. Pool is again one single gap.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0}
+            };
+    check_pool(pool, exp0);
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+
+    pool_segment_t exp1[2] =
+            {
+                    {100, 1},
+                    {pool->total_size-100, 0}
+            };
+    check_pool(pool, exp1);
 
 
+    status = mem_del_alloc(pool, alloc0);
+    assert_int_equal(status, ALLOC_OK);
+
     check_pool(pool, exp0);
 }
 
-static void test_pool_scenario16(void **state) {
+static void test_pool_scenario12(void **state) {
     alloc_status status;
     pool_pt pool = *state;
 
     /*
-     * Scenario 16:
+     * Scenario 12:
      *
      * 1. Pool starts out as a single gap.
      * 2. Allocate 10 x 100.
-     * 3. Deallocate 7, 5, 3, 1
-     * 4. Allocate 50.
-     * 5. Allocate another 50.
-     * 6. Clean up.
+     * 3. Deallocate (1, 2), 4, (6, 7, 8)
+     * 4. Allocate 100.
+     * 5. Clean up.
      */
 
     pool_segment_t exp0[1] =
@@ -1987,68 +2586,43 @@ static void test_pool_scenario16(void **state) {
         allocs[i] = mem_new_alloc(pool, 100);
         assert_non_null(allocs[i]);
     }
-    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK); allocs[7]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[5]), ALLOC_OK); allocs[5]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[3]), ALLOC_OK); allocs[3]=0;
     assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK); allocs[2]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK); allocs[4]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK); allocs[8]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK); allocs[7]=0;
 
-    pool_segment_t exp1[11] =
+    pool_segment_t exp1[8] =
             {
                     {100, 1},
-                    {100, 0},
-                    {100, 1},
-                    {100, 0},
-                    {100, 1},
-                    {100, 0},
+                    {200, 0},
                     {100, 1},
                     {100, 0},
                     {100, 1},
+                    {300, 0},
                     {100, 1},
                     {pool->total_size - 1000, 0},
             };
     check_pool(pool, exp1);
 
 
-    alloc_pt alloc0 = mem_new_alloc(pool, 50);
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
     assert_non_null(alloc0);
-    pool_segment_t exp2[12] =
+    pool_segment_t exp2[8] =
             {
                     {100, 1},
-                    {50, 1},
-                    {50, 0},
-                    {100, 1},
-                    {100, 0},
+                    {200, 0},
                     {100, 1},
-                    {100, 0},
                     {100, 1},
-                    {100, 0},
                     {100, 1},
+                    {300, 0},
                     {100, 1},
                     {pool->total_size - 1000, 0},
             };
     check_pool(pool, exp2);
 
 
-    alloc_pt alloc1 = mem_new_alloc(pool, 50);
-    assert_non_null(alloc1);
-    pool_segment_t exp3[12] =
-            {
-                    {100, 1},
-                    {50, 1},
-                    {50, 1},
-                    {100, 1},
-                    {100, 0},
-                    {100, 1},
-                    {100, 0},
-                    {100, 1},
-                    {100, 0},
-                    {100, 1},
-                    {100, 1},
-                    {pool->total_size - 1000, 0},
-            };
-    check_pool(pool, exp3);
-
-
     // clean up
     for (i=0; i<NUM_ALLOCS; ++i) {
         if (allocs[i])
@@ -2056,25 +2630,23 @@ static void test_pool_scenario16(void **state) {
     }
     free(allocs);
     assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
-    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
-
 
+    
     check_pool(pool, exp0);
 }
 
-static void test_pool_scenario17(void **state) {
+static void test_pool_scenario13(void **state) {
     alloc_status status;
     pool_pt pool = *state;
 
     /*
-     * Scenario 17:
+     * Scenario 13:
      *
      * 1. Pool starts out as a single gap.
      * 2. Allocate 10 x 100.
-     * 3. Deallocate (2, 1, 3), (6, 5), 8
-     * 4. Allocate 50.
-     * 5. Allocate another 50.
-     * 6. Clean up.
+     * 3. Deallocate 1, 4, (6, 7, 8)
+     * 4. Allocate 100.
+     * 5. Clean up.
      */
 
     pool_segment_t exp0[1] =
@@ -2094,59 +2666,42 @@ static void test_pool_scenario17(void **state) {
         allocs[i] = mem_new_alloc(pool, 100);
         assert_non_null(allocs[i]);
     }
-    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK); allocs[2]=0;
     assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[3]), ALLOC_OK); allocs[3]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[5]), ALLOC_OK); allocs[5]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK); allocs[4]=0;
     assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK); allocs[8]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK); allocs[7]=0;
 
-    pool_segment_t exp1[8] =
+    pool_segment_t exp1[9] =
             {
                     {100, 1},
-                    {300, 0},
+                    {100, 0},
                     {100, 1},
-                    {200, 0},
                     {100, 1},
                     {100, 0},
                     {100, 1},
+                    {300, 0},
+                    {100, 1},
                     {pool->total_size - 1000, 0},
             };
     check_pool(pool, exp1);
 
 
-    alloc_pt alloc0 = mem_new_alloc(pool, 50);
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
     assert_non_null(alloc0);
     pool_segment_t exp2[9] =
             {
                     {100, 1},
-                    {300, 0},
                     {100, 1},
-                    {200, 0},
                     {100, 1},
-                    {50, 1},
-                    {50, 0},
                     {100, 1},
-                    {pool->total_size - 1000, 0},
-            };
-    check_pool(pool, exp2);
-
-
-    alloc_pt alloc1 = mem_new_alloc(pool, 50);
-    assert_non_null(alloc1);
-    pool_segment_t exp3[9] =
-            {
+                    {100, 0},
                     {100, 1},
                     {300, 0},
                     {100, 1},
-                    {200, 0},
-                    {100, 1},
-                    {50, 1},
-                    {50, 1},
-                    {100, 1},
                     {pool->total_size - 1000, 0},
             };
-    check_pool(pool, exp3);
+    check_pool(pool, exp2);
 
 
     // clean up
@@ -2156,183 +2711,1683 @@ static void test_pool_scenario17(void **state) {
     }
     free(allocs);
     assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
-    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
 
 
-    check_pool(pool, exp0);
+    check_pool(pool, exp0);
+}
+
+static void test_pool_scenario14(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 14:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 10 x 100.
+     * 3. Deallocate 4, 1, (6, 7, 8) (note: 4 before 1)
+     * 4. Allocate 100.
+     * 5. Clean up.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0},
+            };
+    check_pool(pool, exp0);
+
+
+    const unsigned NUM_ALLOCS = 10;
+
+    alloc_pt *allocs = (alloc_pt *) calloc(NUM_ALLOCS, sizeof(alloc_pt));
+    assert_non_null(allocs);
+
+    int i;
+    for (i=0; i<NUM_ALLOCS; ++i) {
+        allocs[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[i]);
+    }
+    assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK); allocs[4]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK); allocs[8]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK); allocs[7]=0;
+
+    pool_segment_t exp1[9] =
+            {
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {300, 0},
+                    {100, 1},
+                    {pool->total_size - 1000, 0},
+            };
+    check_pool(pool, exp1);
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    pool_segment_t exp2[9] =
+            {
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {300, 0},
+                    {100, 1},
+                    {pool->total_size - 1000, 0},
+            };
+    check_pool(pool, exp2);
+
+
+    // clean up
+    for (i=0; i<NUM_ALLOCS; ++i) {
+        if (allocs[i])
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    free(allocs);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+
+
+    check_pool(pool, exp0);
+}
+
+static void test_pool_scenario15(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 15:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 10 x 100.
+     * 3. Deallocate (1, 2), 4, (6, 7, 8)
+     * 4. Allocate 50.
+     * 5. Allocate another 50.
+     * 6. Clean up.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0},
+            };
+    check_pool(pool, exp0);
+
+
+    const unsigned NUM_ALLOCS = 10;
+
+    alloc_pt *allocs = (alloc_pt *) calloc(NUM_ALLOCS, sizeof(alloc_pt));
+    assert_non_null(allocs);
+
+    int i;
+    for (i=0; i<NUM_ALLOCS; ++i) {
+        allocs[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[i]);
+    }
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK); allocs[2]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK); allocs[4]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK); allocs[8]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK); allocs[7]=0;
+
+    pool_segment_t exp1[8] =
+            {
+                    {100, 1},
+                    {200, 0},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {300, 0},
+                    {100, 1},
+                    {pool->total_size - 1000, 0},
+            };
+    check_pool(pool, exp1);
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc0);
+    pool_segment_t exp2[9] =
+            {
+                    {100, 1},
+                    {200, 0},
+                    {100, 1},
+                    {50, 1},
+                    {50, 0},
+                    {100, 1},
+                    {300, 0},
+                    {100, 1},
+                    {pool->total_size - 1000, 0},
+            };
+    check_pool(pool, exp2);
+
+
+    alloc_pt alloc1 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc1);
+    pool_segment_t exp3[9] =
+            {
+                    {100, 1},
+                    {200, 0},
+                    {100, 1},
+                    {50, 1},
+                    {50, 1},
+                    {100, 1},
+                    {300, 0},
+                    {100, 1},
+                    {pool->total_size - 1000, 0},
+            };
+    check_pool(pool, exp3);
+
+
+    // clean up
+    for (i=0; i<NUM_ALLOCS; ++i) {
+        if (allocs[i])
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    free(allocs);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+
+    check_pool(pool, exp0);
+}
+
+static void test_pool_scenario16(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 16:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 10 x 100.
+     * 3. Deallocate 7, 5, 3, 1
+     * 4. Allocate 50.
+     * 5. Allocate another 50.
+     * 6. Clean up.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0},
+            };
+    check_pool(pool, exp0);
+
+
+    const unsigned NUM_ALLOCS = 10;
+
+    alloc_pt *allocs = (alloc_pt *) calloc(NUM_ALLOCS, sizeof(alloc_pt));
+    assert_non_null(allocs);
+
+    int i;
+    for (i=0; i<NUM_ALLOCS; ++i) {
+        allocs[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[i]);
+    }
+    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK); allocs[7]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[5]), ALLOC_OK); allocs[5]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[3]), ALLOC_OK); allocs[3]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
+
+    pool_segment_t exp1[11] =
+            {
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {100, 1},
+                    {pool->total_size - 1000, 0},
+            };
+    check_pool(pool, exp1);
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc0);
+    pool_segment_t exp2[12] =
+            {
+                    {100, 1},
+                    {50, 1},
+                    {50, 0},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {100, 1},
+                    {pool->total_size - 1000, 0},
+            };
+    check_pool(pool, exp2);
+
+
+    alloc_pt alloc1 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc1);
+    pool_segment_t exp3[12] =
+            {
+                    {100, 1},
+                    {50, 1},
+                    {50, 1},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {100, 1},
+                    {pool->total_size - 1000, 0},
+            };
+    check_pool(pool, exp3);
+
+
+    // clean up
+    for (i=0; i<NUM_ALLOCS; ++i) {
+        if (allocs[i])
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    free(allocs);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+
+    check_pool(pool, exp0);
+}
+
+static void test_pool_scenario17(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 17:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 10 x 100.
+     * 3. Deallocate (2, 1, 3), (6, 5), 8
+     * 4. Allocate 50.
+     * 5. Allocate another 50.
+     * 6. Clean up.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0},
+            };
+    check_pool(pool, exp0);
+
+
+    const unsigned NUM_ALLOCS = 10;
+
+    alloc_pt *allocs = (alloc_pt *) calloc(NUM_ALLOCS, sizeof(alloc_pt));
+    assert_non_null(allocs);
+
+    int i;
+    for (i=0; i<NUM_ALLOCS; ++i) {
+        allocs[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[i]);
+    }
+    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK); allocs[2]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[3]), ALLOC_OK); allocs[3]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[5]), ALLOC_OK); allocs[5]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK); allocs[8]=0;
+
+    pool_segment_t exp1[8] =
+            {
+                    {100, 1},
+                    {300, 0},
+                    {100, 1},
+                    {200, 0},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {pool->total_size - 1000, 0},
+            };
+    check_pool(pool, exp1);
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc0);
+    pool_segment_t exp2[9] =
+            {
+                    {100, 1},
+                    {300, 0},
+                    {100, 1},
+                    {200, 0},
+                    {100, 1},
+                    {50, 1},
+                    {50, 0},
+                    {100, 1},
+                    {pool->total_size - 1000, 0},
+            };
+    check_pool(pool, exp2);
+
+
+    alloc_pt alloc1 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc1);
+    pool_segment_t exp3[9] =
+            {
+                    {100, 1},
+                    {300, 0},
+                    {100, 1},
+                    {200, 0},
+                    {100, 1},
+                    {50, 1},
+                    {50, 1},
+                    {100, 1},
+                    {pool->total_size - 1000, 0},
+            };
+    check_pool(pool, exp3);
+
+
+    // clean up
+    for (i=0; i<NUM_ALLOCS; ++i) {
+        if (allocs[i])
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    free(allocs);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+
+    check_pool(pool, exp0);
+}
+
+static void test_pool_scenario18(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 18:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 10 x 100.
+     * 3. Deallocate (2, 1, 3), (6, 5), 8
+     * 4. Allocate 999000.
+     * 5. Try to Allocate 350. Should fail.
+     * 6. Clean up.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0},
+            };
+    check_pool(pool, exp0);
+
+
+    const unsigned NUM_ALLOCS = 10;
+
+    alloc_pt *allocs = (alloc_pt *) calloc(NUM_ALLOCS, sizeof(alloc_pt));
+    assert_non_null(allocs);
+
+    int i;
+    for (i=0; i<NUM_ALLOCS; ++i) {
+        allocs[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[i]);
+    }
+    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK); allocs[2]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[3]), ALLOC_OK); allocs[3]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[5]), ALLOC_OK); allocs[5]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK); allocs[8]=0;
+
+    pool_segment_t exp1[8] =
+            {
+                    {100, 1},
+                    {300, 0},
+                    {100, 1},
+                    {200, 0},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {pool->total_size - 1000, 0},
+            };
+    check_pool(pool, exp1);
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 999000);
+    assert_non_null(alloc0);
+    pool_segment_t exp2[8] =
+            {
+                    {100, 1},
+                    {300, 0},
+                    {100, 1},
+                    {200, 0},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {pool->total_size - 1000, 1},
+            };
+    check_pool(pool, exp2);
+
+
+    alloc_pt alloc1 = mem_new_alloc(pool, 350);
+    assert_null(alloc1);
+    check_pool(pool, exp2);
+
+
+    // clean up
+    for (i=0; i<NUM_ALLOCS; ++i) {
+        if (allocs[i])
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    free(allocs);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+
+
+    check_pool(pool, exp0);
+}
+
+static void test_pool_scenario19(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 19:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 10 x 100.
+     * 3. Deallocate (2, 1, 3), (6, 5), 8
+     * 4. Allocate 150.
+     * 6. Clean up.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0},
+            };
+    check_pool(pool, exp0);
+
+
+    const unsigned NUM_ALLOCS = 10;
+
+    alloc_pt *allocs = (alloc_pt *) calloc(NUM_ALLOCS, sizeof(alloc_pt));
+    assert_non_null(allocs);
+
+    int i;
+    for (i=0; i<NUM_ALLOCS; ++i) {
+        allocs[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[i]);
+    }
+    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK); allocs[2]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[3]), ALLOC_OK); allocs[3]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[5]), ALLOC_OK); allocs[5]=0;
+    assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK); allocs[8]=0;
+
+    pool_segment_t exp1[8] =
+            {
+                    {100, 1},
+                    {300, 0},
+                    {100, 1},
+                    {200, 0},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {pool->total_size - 1000, 0},
+            };
+    check_pool(pool, exp1);
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 150);
+    assert_non_null(alloc0);
+    pool_segment_t exp2[9] =
+            {
+                    {100, 1},
+                    {300, 0},
+                    {100, 1},
+                    {150, 1},
+                    {50, 0},
+                    {100, 1},
+                    {100, 0},
+                    {100, 1},
+                    {pool->total_size - 1000, 0},
+            };
+    check_pool(pool, exp2);
+
+
+    // clean up
+    for (i=0; i<NUM_ALLOCS; ++i) {
+        if (allocs[i])
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    free(allocs);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+
+
+    check_pool(pool, exp0);
+}
+
+static void test_pool_scenario20(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 20:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 700, 100, 600, 200, 500, 300, 400, each followed by 10.
+     * 3. Deallocate the 7 big allocations (gap index gets rebalanced).
+     * 4. Allocate 250, 100, 650. Each goes to the smallest sufficient gap.
+     * 5. Clean up.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0},
+            };
+    check_pool(pool, exp0);
+
+
+    const unsigned NUM_GAPS = 7;
+    const size_t gap_sizes[] = {700, 100, 600, 200, 500, 300, 400};
+
+    alloc_pt *allocs = (alloc_pt *) calloc(2 * NUM_GAPS, sizeof(alloc_pt));
+    assert_non_null(allocs);
+
+    int i;
+    for (i=0; i<NUM_GAPS; ++i) {
+        allocs[2*i] = mem_new_alloc(pool, gap_sizes[i]);
+        assert_non_null(allocs[2*i]);
+        allocs[2*i+1] = mem_new_alloc(pool, 10);
+        assert_non_null(allocs[2*i+1]);
+    }
+    for (i=0; i<NUM_GAPS; ++i) {
+        assert_int_equal(mem_del_alloc(pool, allocs[2*i]), ALLOC_OK);
+        allocs[2*i] = NULL;
+    }
+    assert_int_equal(pool->num_gaps, NUM_GAPS + 1);
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 250);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 650);
+    assert_non_null(alloc2);
+    pool_segment_t exp1[17] =
+            {
+                    {650, 1},
+                    {50, 0},
+                    {10, 1},
+                    {100, 1},
+                    {10, 1},
+                    {600, 0},
+                    {10, 1},
+                    {200, 0},
+                    {10, 1},
+                    {500, 0},
+                    {10, 1},
+                    {250, 1},
+                    {50, 0},
+                    {10, 1},
+                    {400, 0},
+                    {10, 1},
+                    {pool->total_size - 2870, 0},
+            };
+    check_pool(pool, exp1);
+
+
+    // clean up
+    for (i=0; i<2*NUM_GAPS; ++i) {
+        if (allocs[i])
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    free(allocs);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+
+    check_pool(pool, exp0);
+}
+
+static void test_pool_scenario28(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 28:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 1000 blocks of distinct sizes 10..1009 in shuffled
+     *    order, each followed by 1.
+     * 3. Deallocate the 1000 blocks, leaving 1001 gaps.
+     * 4. Allocate 500, 1009, 1010. Each goes to the only gap of that
+     *    exact size; 1010 only fits the top gap.
+     * 5. Clean up.
+     */
+
+    const unsigned NUM_GAPS = 1000;
+    alloc_pt *allocs = (alloc_pt *) calloc(2 * NUM_GAPS, sizeof(alloc_pt));
+    assert_non_null(allocs);
+    char **gap_mem = (char **) calloc(NUM_GAPS + 1, sizeof(char *));
+    assert_non_null(gap_mem);
+
+    unsigned i;
+    size_t used = 0;
+    for (i=0; i<NUM_GAPS; ++i) {
+        size_t size = 10 + (i * 7919) % NUM_GAPS;
+        allocs[2*i] = mem_new_alloc(pool, size);
+        assert_non_null(allocs[2*i]);
+        gap_mem[size - 10] = allocs[2*i]->mem;
+        allocs[2*i+1] = mem_new_alloc(pool, 1);
+        assert_non_null(allocs[2*i+1]);
+        used += size + 1;
+    }
+    gap_mem[NUM_GAPS] = pool->mem + used;
+    for (i=0; i<NUM_GAPS; ++i) {
+        assert_int_equal(mem_del_alloc(pool, allocs[2*i]), ALLOC_OK);
+        allocs[2*i] = NULL;
+    }
+    assert_int_equal(pool->num_gaps, NUM_GAPS + 1);
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 500);
+    assert_non_null(alloc0);
+    assert_ptr_equal(alloc0->mem, gap_mem[500 - 10]);
+    alloc_pt alloc1 = mem_new_alloc(pool, 1009);
+    assert_non_null(alloc1);
+    assert_ptr_equal(alloc1->mem, gap_mem[1009 - 10]);
+    alloc_pt alloc2 = mem_new_alloc(pool, 1010);
+    assert_non_null(alloc2);
+    assert_ptr_equal(alloc2->mem, gap_mem[NUM_GAPS]);
+    assert_int_equal(pool->num_gaps, NUM_GAPS - 1);
+
+
+    // clean up
+    for (i=0; i<2*NUM_GAPS; ++i) {
+        if (allocs[i])
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    free(allocs);
+    free(gap_mem);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+    check_metadata(pool, BEST_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+static void test_pool_scenario38(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 38:
+     *
+     * 1. Allocate 10, three times 0, and 10.
+     * 2. Deallocate the first and the last 0. The two 0-byte gaps have
+     *    the same size and the same offset.
+     * 3. Allocate 0 twice. Each takes one of the two gaps.
+     * 4. Clean up.
+     */
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 10);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 0);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 0);
+    assert_non_null(alloc2);
+    alloc_pt alloc3 = mem_new_alloc(pool, 0);
+    assert_non_null(alloc3);
+    alloc_pt alloc4 = mem_new_alloc(pool, 10);
+    assert_non_null(alloc4);
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    check_metadata(pool, BEST_FIT, POOL_SIZE, 20, 3, 3);
+
+
+    alloc_pt alloc5 = mem_new_alloc(pool, 0);
+    assert_non_null(alloc5);
+    alloc_pt alloc6 = mem_new_alloc(pool, 0);
+    assert_non_null(alloc6);
+    assert_ptr_not_equal(alloc5, alloc6);
+    assert_ptr_equal(alloc5->mem, pool->mem + 10);
+    assert_ptr_equal(alloc6->mem, pool->mem + 10);
+    check_metadata(pool, BEST_FIT, POOL_SIZE, 20, 5, 1);
+
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc5), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc6), ALLOC_OK);
+
+    check_metadata(pool, BEST_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+/*******************************************/
+/***          5. TLSF SCENARIOS          ***/
+/*******************************************/
+
+static int pool_tlsf_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = TLSF;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes with policy %s\n",
+         (long) POOL_SIZE, "TLSF");
+    pool = mem_pool_open(POOL_SIZE, POOL_POLICY);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static int pool_tlsf_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void test_pool_scenario22(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 22:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 100, 1000, 10000.
+     * 3. Deallocate the 1000.
+     * 4. Allocate 500. Goes in the 1000 gap (next size class up).
+     * 5. Allocate the rest of the pool exactly.
+     * 6. Clean up.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, TLSF, POOL_SIZE, 0, 0, 1);
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 1000);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 10000);
+    assert_non_null(alloc2);
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    check_metadata(pool, TLSF, POOL_SIZE, 10100, 2, 2);
+
+
+    alloc_pt alloc3 = mem_new_alloc(pool, 500);
+    assert_non_null(alloc3);
+
+    pool_segment_t exp1[5] =
+            {
+                    {100, 1},
+                    {500, 1},
+                    {500, 0},
+                    {10000, 1},
+                    {pool->total_size - 11100, 0}
+            };
+    check_pool(pool, exp1);
+
+
+    alloc_pt alloc4 = mem_new_alloc(pool, pool->total_size - 11100);
+    assert_non_null(alloc4);
+
+    pool_segment_t exp2[5] =
+            {
+                    {100, 1},
+                    {500, 1},
+                    {500, 0},
+                    {10000, 1},
+                    {pool->total_size - 11100, 1}
+            };
+    check_pool(pool, exp2);
+    check_metadata(pool, TLSF, POOL_SIZE, POOL_SIZE - 500, 4, 1);
+
+    assert_null(mem_new_alloc(pool, 501));
+
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+
+    check_pool(pool, exp0);
+    check_metadata(pool, TLSF, POOL_SIZE, 0, 0, 1);
+}
+
+static void test_pool_scenario23(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 23:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 10 x 100.
+     * 3. Deallocate 1, 3, 5, 7 (4 gaps of 100 in the same size class).
+     * 4. Allocate 4 x 100. They fill the 4 gaps, not the rest of the pool.
+     * 5. Clean up.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0}
+            };
+    check_pool(pool, exp0);
+
+
+    const unsigned NUM_ALLOCS = 10;
+
+    alloc_pt *allocs = (alloc_pt *) calloc(NUM_ALLOCS, sizeof(alloc_pt));
+    assert_non_null(allocs);
+
+    int i;
+    for (i=0; i<NUM_ALLOCS; ++i) {
+        allocs[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[i]);
+    }
+    for (i=1; i<8; i+=2) {
+        assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+        allocs[i] = NULL;
+    }
+    check_metadata(pool, TLSF, POOL_SIZE, 600, 6, 5);
+
+    for (i=1; i<8; i+=2) {
+        allocs[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[i]);
+    }
+
+    pool_segment_t exp1[11] =
+            {
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {100, 1},
+                    {pool->total_size - 1000, 0}
+            };
+    check_pool(pool, exp1);
+
+
+    // clean up
+    for (i=0; i<NUM_ALLOCS; ++i) {
+        if (allocs[i])
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    free(allocs);
+
+    check_pool(pool, exp0);
+}
+
+/*******************************************/
+/***         6. BUDDY SCENARIOS          ***/
+/*******************************************/
+
+static int pool_buddy_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = BUDDY;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes with policy %s\n",
+         (long) POOL_SIZE, "BUDDY");
+    pool = mem_pool_open(POOL_SIZE, POOL_POLICY);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static int pool_buddy_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void test_pool_scenario24(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 24:
+     *
+     * 1. Pool starts out as one free block per set bit of its size.
+     * 2. Allocate 100. Rounds up to 128, split from the 512 block.
+     * 3. Allocate 60. Rounds up to 64, takes the 64 block whole.
+     * 4. Deallocate the 128. Merges back into the 512 block.
+     * 5. Deallocate the 64.
+     */
+
+    pool_segment_t exp0[7] =
+            {
+                    {524288, 0},
+                    {262144, 0},
+                    {131072, 0},
+                    {65536, 0},
+                    {16384, 0},
+                    {512, 0},
+                    {64, 0},
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, BUDDY, POOL_SIZE, 0, 0, 7);
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    assert_int_equal(alloc0->size, 128);
+    assert_int_equal((alloc0->mem - pool->mem) % 128, 0);
+
+    pool_segment_t exp1[9] =
+            {
+                    {524288, 0},
+                    {262144, 0},
+                    {131072, 0},
+                    {65536, 0},
+                    {16384, 0},
+                    {128, 1},
+                    {128, 0},
+                    {256, 0},
+                    {64, 0},
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, BUDDY, POOL_SIZE, 128, 1, 8);
+
+
+    alloc_pt alloc1 = mem_new_alloc(pool, 60);
+    assert_non_null(alloc1);
+    assert_int_equal(alloc1->size, 64);
+
+    pool_segment_t exp2[9] =
+            {
+                    {524288, 0},
+                    {262144, 0},
+                    {131072, 0},
+                    {65536, 0},
+                    {16384, 0},
+                    {128, 1},
+                    {128, 0},
+                    {256, 0},
+                    {64, 1},
+            };
+    check_pool(pool, exp2);
+
+
+    status = mem_del_alloc(pool, alloc0);
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_segment_t exp3[7] =
+            {
+                    {524288, 0},
+                    {262144, 0},
+                    {131072, 0},
+                    {65536, 0},
+                    {16384, 0},
+                    {512, 0},
+                    {64, 1},
+            };
+    check_pool(pool, exp3);
+    check_metadata(pool, BUDDY, POOL_SIZE, 64, 1, 6);
+
+
+    status = mem_del_alloc(pool, alloc1);
+    assert_int_equal(status, ALLOC_OK);
+
+    check_pool(pool, exp0);
+    check_metadata(pool, BUDDY, POOL_SIZE, 0, 0, 7);
+}
+
+static void test_pool_scenario25(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 25:
+     *
+     * 1. Pool starts out as one free block per set bit of its size.
+     * 2. Allocate 4 x 16384. The first takes the 16384 block, the rest
+     *    split the 65536 block.
+     * 3. Deallocate 2, 3. 2's buddy (1) is allocated, so it stays a
+     *    16384 gap next to the 32768 gap that 3 merged into.
+     * 4. Deallocate 1 (merges with 2, then with the 32768) and 0.
+     */
+
+    alloc_pt allocs[4];
+    int i;
+    for (i=0; i<4; ++i) {
+        allocs[i] = mem_new_alloc(pool, 16384);
+        assert_non_null(allocs[i]);
+    }
+
+    pool_segment_t exp1[10] =
+            {
+                    {524288, 0},
+                    {262144, 0},
+                    {131072, 0},
+                    {16384, 1},
+                    {16384, 1},
+                    {16384, 1},
+                    {16384, 0},
+                    {16384, 1},
+                    {512, 0},
+                    {64, 0},
+            };
+    check_pool(pool, exp1);
+
+
+    status = mem_del_alloc(pool, allocs[2]);
+    assert_int_equal(status, ALLOC_OK);
+    status = mem_del_alloc(pool, allocs[3]);
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_segment_t exp2[9] =
+            {
+                    {524288, 0},
+                    {262144, 0},
+                    {131072, 0},
+                    {16384, 1},
+                    {16384, 0},
+                    {32768, 0},
+                    {16384, 1},
+                    {512, 0},
+                    {64, 0},
+            };
+    check_pool(pool, exp2);
+
+
+    status = mem_del_alloc(pool, allocs[1]);
+    assert_int_equal(status, ALLOC_OK);
+    check_metadata(pool, BUDDY, POOL_SIZE, 16384, 1, 6);
+
+    status = mem_del_alloc(pool, allocs[0]);
+    assert_int_equal(status, ALLOC_OK);
+
+    check_metadata(pool, BUDDY, POOL_SIZE, 0, 0, 7);
+}
+
+/*******************************************/
+/***       7. FIXED-SIZE SCENARIOS       ***/
+/*******************************************/
+
+static const unsigned FIXED_OBJ_SIZE = 64;
+static const unsigned FIXED_NUM_OBJS = 100;
+
+static int pool_fixed_setup(void **state) {
+    alloc_status status;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating fixed pool of %u x %u bytes\n",
+         FIXED_NUM_OBJS, FIXED_OBJ_SIZE);
+    pool = mem_pool_open_fixed(FIXED_OBJ_SIZE, FIXED_NUM_OBJS);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static int pool_fixed_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void test_pool_scenario26(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 26:
+     *
+     * 1. Pool starts out as a single gap of 100 x 64.
+     * 2. Allocate 3 objects. Try to allocate more than 64. Should fail.
+     * 3. Deallocate the 2nd. Pool has two gaps.
+     * 4. Allocate another object. Reuses the 2nd.
+     * 5. Clean up.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {FIXED_OBJ_SIZE * FIXED_NUM_OBJS, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIXED, FIXED_OBJ_SIZE * FIXED_NUM_OBJS, 0, 0, 1);
+
+    assert_null(mem_pool_open(1000, FIXED));
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, FIXED_OBJ_SIZE);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 10);
+    assert_non_null(alloc1);
+    assert_int_equal(alloc1->size, FIXED_OBJ_SIZE);
+    alloc_pt alloc2 = mem_new_alloc(pool, FIXED_OBJ_SIZE);
+    assert_non_null(alloc2);
+    assert_null(mem_new_alloc(pool, FIXED_OBJ_SIZE + 1));
+
+    pool_segment_t exp1[4] =
+            {
+                    {FIXED_OBJ_SIZE, 1},
+                    {FIXED_OBJ_SIZE, 1},
+                    {FIXED_OBJ_SIZE, 1},
+                    {FIXED_OBJ_SIZE * (FIXED_NUM_OBJS - 3), 0}
+            };
+    check_pool(pool, exp1);
+
+
+    char *mem1 = alloc1->mem;
+    status = mem_del_alloc(pool, alloc1);
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_segment_t exp2[4] =
+            {
+                    {FIXED_OBJ_SIZE, 1},
+                    {FIXED_OBJ_SIZE, 0},
+                    {FIXED_OBJ_SIZE, 1},
+                    {FIXED_OBJ_SIZE * (FIXED_NUM_OBJS - 3), 0}
+            };
+    check_pool(pool, exp2);
+    check_metadata(pool, FIXED, FIXED_OBJ_SIZE * FIXED_NUM_OBJS,
+                   2 * FIXED_OBJ_SIZE, 2, 2);
+
+
+    alloc_pt alloc3 = mem_new_alloc(pool, FIXED_OBJ_SIZE);
+    assert_non_null(alloc3);
+    assert_true(alloc3->mem == mem1);
+    check_pool(pool, exp1);
+
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+
+    check_pool(pool, exp0);
+}
+
+static void test_pool_scenario27(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 27:
+     *
+     * 1. Pool starts out as a single gap of 100 x 64.
+     * 2. Allocate all 100 objects. The next allocation fails.
+     * 3. Deallocate every other object. Pool has 50 gaps.
+     * 4. Clean up.
+     */
+
+    alloc_pt allocs[FIXED_NUM_OBJS];
+    int i;
+    for (i=0; i<FIXED_NUM_OBJS; ++i) {
+        allocs[i] = mem_new_alloc(pool, FIXED_OBJ_SIZE);
+        assert_non_null(allocs[i]);
+    }
+    assert_null(mem_new_alloc(pool, FIXED_OBJ_SIZE));
+    check_metadata(pool, FIXED, FIXED_OBJ_SIZE * FIXED_NUM_OBJS,
+                   FIXED_OBJ_SIZE * FIXED_NUM_OBJS, FIXED_NUM_OBJS, 0);
+
+    for (i=1; i<FIXED_NUM_OBJS; i+=2) {
+        assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+        allocs[i] = NULL;
+    }
+    check_metadata(pool, FIXED, FIXED_OBJ_SIZE * FIXED_NUM_OBJS,
+                   FIXED_OBJ_SIZE * FIXED_NUM_OBJS / 2,
+                   FIXED_NUM_OBJS / 2, FIXED_NUM_OBJS / 2);
+
+
+    // clean up
+    for (i=0; i<FIXED_NUM_OBJS; ++i) {
+        if (allocs[i])
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+
+    check_metadata(pool, FIXED, FIXED_OBJ_SIZE * FIXED_NUM_OBJS, 0, 0, 1);
+}
+
+/*******************************************/
+/***       8. NEXT_FIT SCENARIOS         ***/
+/*******************************************/
+
+static int pool_nf_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = NEXT_FIT;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes with policy %s\n",
+         (long) POOL_SIZE, "NEXT_FIT");
+    pool = mem_pool_open(POOL_SIZE, POOL_POLICY);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
+}
+
+static int pool_nf_teardown(void **state) {
+    pool_pt pool = *state;
+    alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void test_pool_scenario29(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 29:
+     *
+     * 1. Pool starts out as a single gap.
+     * 2. Allocate 100, 200, 300.
+     * 3. Deallocate the 100. Allocate 50, which goes after the 300
+     *    (where the last allocation ended), not into the front gap.
+     * 4. Deallocate the 300 and the 200 (all three merge). Allocate the
+     *    rest of the top gap, then 10, which wraps around to the front.
+     * 5. Deallocate the 10 (merges with the gap after it, so the rover
+     *    is now inside that gap). Allocate 20, which goes to its start.
+     * 6. Clean up.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0},
+            };
+    check_pool(pool, exp0);
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 300);
+    assert_non_null(alloc2);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    alloc_pt alloc3 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc3);
+    pool_segment_t exp1[5] =
+            {
+                    {100, 0},
+                    {200, 1},
+                    {300, 1},
+                    {50, 1},
+                    {pool->total_size - 650, 0},
+            };
+    check_pool(pool, exp1);
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    alloc_pt alloc4 = mem_new_alloc(pool, pool->total_size - 650);
+    assert_non_null(alloc4);
+    alloc_pt alloc5 = mem_new_alloc(pool, 10);
+    assert_non_null(alloc5);
+    pool_segment_t exp2[4] =
+            {
+                    {10, 1},
+                    {590, 0},
+                    {50, 1},
+                    {pool->total_size - 650, 1},
+            };
+    check_pool(pool, exp2);
+
+
+    assert_int_equal(mem_del_alloc(pool, alloc5), ALLOC_OK);
+    alloc_pt alloc6 = mem_new_alloc(pool, 20);
+    assert_non_null(alloc6);
+    pool_segment_t exp3[4] =
+            {
+                    {20, 1},
+                    {580, 0},
+                    {50, 1},
+                    {pool->total_size - 650, 1},
+            };
+    check_pool(pool, exp3);
+
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc6), ALLOC_OK);
+    check_pool(pool, exp0);
+}
+
+static void test_pool_scenario40(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 40:
+     *
+     * 1. Allocate 10, three times 0, 10, and the rest of the pool.
+     * 2. Deallocate the first and the last 0. The two 0-byte gaps have
+     *    the same offset and are the only gaps.
+     * 3. Allocate 0 twice. Both wrap around to the front, and each
+     *    takes one of the two gaps.
+     * 4. Clean up.
+     */
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 10);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 0);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 0);
+    assert_non_null(alloc2);
+    alloc_pt alloc3 = mem_new_alloc(pool, 0);
+    assert_non_null(alloc3);
+    alloc_pt alloc4 = mem_new_alloc(pool, 10);
+    assert_non_null(alloc4);
+    alloc_pt alloc5 = mem_new_alloc(pool, POOL_SIZE - 20);
+    assert_non_null(alloc5);
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    check_metadata(pool, NEXT_FIT, POOL_SIZE, POOL_SIZE, 4, 2);
+
+
+    alloc_pt alloc6 = mem_new_alloc(pool, 0);
+    assert_non_null(alloc6);
+    alloc_pt alloc7 = mem_new_alloc(pool, 0);
+    assert_non_null(alloc7);
+    assert_ptr_not_equal(alloc6, alloc7);
+    assert_ptr_equal(alloc6->mem, pool->mem + 10);
+    assert_ptr_equal(alloc7->mem, pool->mem + 10);
+    check_metadata(pool, NEXT_FIT, POOL_SIZE, POOL_SIZE, 6, 0);
+
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc5), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc6), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc7), ALLOC_OK);
+
+    check_metadata(pool, NEXT_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+static void test_pool_scenario41(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Scenario 41:
+     *
+     * 1. Allocate seven times 10 and the rest of the pool.
+     * 2. Deallocate the 2nd, 3rd and 4th (they merge), the 6th and the
+     *    rest.
+     * 3. Allocate 30, which wraps around into the front gap.
+     * 4. Allocate 0 twice, both at the start of the 10-byte gap, and
+     *    deallocate the first. A 0-byte gap and the 10-byte gap now
+     *    start where the last allocation ended.
+     * 5. Allocate 5, which goes into the 10-byte gap, not past the 7th.
+     * 6. Clean up.
+     */
+
+    alloc_pt allocs[8];
+    unsigned i;
+    for (i=0; i<7; ++i) {
+        allocs[i] = mem_new_alloc(pool, 10);
+        assert_non_null(allocs[i]);
+    }
+    allocs[7] = mem_new_alloc(pool, POOL_SIZE - 70);
+    assert_non_null(allocs[7]);
+
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[3]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[5]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[7]), ALLOC_OK);
+    check_metadata(pool, NEXT_FIT, POOL_SIZE, 30, 3, 3);
+
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 30);
+    assert_non_null(alloc0);
+    assert_ptr_equal(alloc0->mem, pool->mem + 10);
+
+    alloc_pt alloc1 = mem_new_alloc(pool, 0);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 0);
+    assert_non_null(alloc2);
+    assert_ptr_equal(alloc1->mem, pool->mem + 50);
+    assert_ptr_equal(alloc2->mem, pool->mem + 50);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    check_metadata(pool, NEXT_FIT, POOL_SIZE, 60, 5, 3);
+
+
+    alloc_pt alloc3 = mem_new_alloc(pool, 5);
+    assert_non_null(alloc3);
+    assert_ptr_equal(alloc3->mem, pool->mem + 50);
+    check_metadata(pool, NEXT_FIT, POOL_SIZE, 65, 6, 3);
+
+
+    // clean up
+    assert_int_equal(mem_del_alloc(pool, allocs[0]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[4]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+
+    check_metadata(pool, NEXT_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+/*******************************************/
+/***         9. ARENA SCENARIOS          ***/
+/*******************************************/
+
+static int pool_arena_setup(void **state) {
+    alloc_status status;
+    const alloc_policy POOL_POLICY = ARENA;
+    pool_pt pool = NULL;
+
+    status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    INFO("Allocating pool of %lu bytes with policy %s\n",
+         (long) POOL_SIZE, "ARENA");
+    pool = mem_pool_open(POOL_SIZE, POOL_POLICY);
+    assert_non_null(pool);
+
+    *state = pool;
+
+    return 0;
 }
 
-static void test_pool_scenario18(void **state) {
+static int pool_arena_teardown(void **state) {
+    pool_pt pool = *state;
     alloc_status status;
+
+    INFO("Closing pool\n");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+
+    return 0;
+}
+
+static void test_pool_scenario32(void **state) {
     pool_pt pool = *state;
 
     /*
-     * Scenario 18:
+     * Scenario 32:
      *
      * 1. Pool starts out as a single gap.
-     * 2. Allocate 10 x 100.
-     * 3. Deallocate (2, 1, 3), (6, 5), 8
-     * 4. Allocate 999000.
-     * 5. Try to Allocate 350. Should fail.
-     * 6. Clean up.
+     * 2. Allocate 100, 200, 300. They are back to back.
+     * 3. Deallocate the 100. Fails, it is not the latest. Deallocate
+     *    the 300. Allocate 50, which takes its place.
+     * 4. The pool does not close. Reset it. Pool is a single gap.
+     * 5. Allocate 1000 x 10 and reset. Pool is a single gap.
+     * 6. A 0-byte pool opens and closes.
      */
 
     pool_segment_t exp0[1] =
             {
-                    {pool->total_size, 0},
+                    {pool->total_size, 0}
             };
     check_pool(pool, exp0);
+    check_metadata(pool, ARENA, pool->total_size, 0, 0, 1);
+    assert_int_equal(mem_new_handle(pool, 10), 0);
+    assert_int_equal(mem_pool_set_quick_lists(pool, 64), ALLOC_FAIL);
+    assert_null(mem_pool_open_sharded(POOL_SIZE, ARENA, 4));
 
 
-    const unsigned NUM_ALLOCS = 10;
-
-    alloc_pt *allocs = (alloc_pt *) calloc(NUM_ALLOCS, sizeof(alloc_pt));
-    assert_non_null(allocs);
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 300);
+    assert_non_null(alloc2);
+    assert_ptr_equal(alloc1->mem, alloc0->mem + 100);
+    assert_ptr_equal(alloc2->mem, alloc1->mem + 200);
 
-    int i;
-    for (i=0; i<NUM_ALLOCS; ++i) {
-        allocs[i] = mem_new_alloc(pool, 100);
-        assert_non_null(allocs[i]);
-    }
-    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK); allocs[2]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[3]), ALLOC_OK); allocs[3]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[5]), ALLOC_OK); allocs[5]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK); allocs[8]=0;
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_FAIL);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    alloc_pt alloc3 = mem_new_alloc(pool, 50);
+    assert_non_null(alloc3);
+    assert_ptr_equal(alloc3->mem, alloc1->mem + 200);
 
-    pool_segment_t exp1[8] =
+    pool_segment_t exp1[4] =
             {
                     {100, 1},
-                    {300, 0},
-                    {100, 1},
-                    {200, 0},
-                    {100, 1},
-                    {100, 0},
-                    {100, 1},
-                    {pool->total_size - 1000, 0},
+                    {200, 1},
+                    {50, 1},
+                    {pool->total_size - 350, 0}
             };
     check_pool(pool, exp1);
+    check_metadata(pool, ARENA, pool->total_size, 350, 3, 1);
 
 
-    alloc_pt alloc0 = mem_new_alloc(pool, 999000);
-    assert_non_null(alloc0);
-    pool_segment_t exp2[8] =
-            {
-                    {100, 1},
-                    {300, 0},
-                    {100, 1},
-                    {200, 0},
-                    {100, 1},
-                    {100, 0},
-                    {100, 1},
-                    {pool->total_size - 1000, 1},
-            };
-    check_pool(pool, exp2);
-
-
-    alloc_pt alloc1 = mem_new_alloc(pool, 350);
-    assert_null(alloc1);
-    check_pool(pool, exp2);
+    assert_int_equal(mem_pool_close(pool), ALLOC_NOT_FREED);
+    assert_int_equal(mem_pool_reset(pool), ALLOC_OK);
+    check_pool(pool, exp0);
+    check_metadata(pool, ARENA, pool->total_size, 0, 0, 1);
 
 
-    // clean up
-    for (i=0; i<NUM_ALLOCS; ++i) {
-        if (allocs[i])
-            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    for (unsigned i = 0; i < 1000; ++i) {
+        assert_non_null(mem_new_alloc(pool, 10));
     }
-    free(allocs);
-    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
-
+    check_metadata(pool, ARENA, pool->total_size, 10000, 1000, 1);
+    assert_int_equal(mem_pool_reset(pool), ALLOC_OK);
 
     check_pool(pool, exp0);
+    check_metadata(pool, ARENA, pool->total_size, 0, 0, 1);
+
+
+    pool_pt empty = mem_pool_open(0, ARENA);
+    assert_non_null(empty);
+    assert_int_equal(empty->num_allocs, 0);
+    assert_int_equal(empty->num_gaps, 0);
+    assert_null(mem_new_alloc(empty, 1));
+    assert_int_equal(mem_pool_close(empty), ALLOC_OK);
 }
 
-static void test_pool_scenario19(void **state) {
-    alloc_status status;
+static void test_pool_scenario34(void **state) {
     pool_pt pool = *state;
 
     /*
-     * Scenario 19:
+     * Scenario 34:
      *
      * 1. Pool starts out as a single gap.
-     * 2. Allocate 10 x 100.
-     * 3. Deallocate (2, 1, 3), (6, 5), 8
-     * 4. Allocate 150.
-     * 6. Clean up.
+     * 2. Allocate 100. Mark (at 100).
+     * 3. Allocate 200, 300. Rewind. Only the 100 is left.
+     * 4. Allocate 50 and rewind to the start. Pool is a single gap.
      */
 
     pool_segment_t exp0[1] =
             {
-                    {pool->total_size, 0},
+                    {pool->total_size, 0}
             };
     check_pool(pool, exp0);
 
 
-    const unsigned NUM_ALLOCS = 10;
+    assert_non_null(mem_new_alloc(pool, 100));
+    mem_pool_mark_t mark0;
+    assert_int_equal(mem_pool_mark(pool, &mark0), ALLOC_OK);
+    assert_int_equal(mark0, 100);
 
-    alloc_pt *allocs = (alloc_pt *) calloc(NUM_ALLOCS, sizeof(alloc_pt));
-    assert_non_null(allocs);
 
-    int i;
-    for (i=0; i<NUM_ALLOCS; ++i) {
-        allocs[i] = mem_new_alloc(pool, 100);
-        assert_non_null(allocs[i]);
-    }
-    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK); allocs[2]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK); allocs[1]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[3]), ALLOC_OK); allocs[3]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[6]), ALLOC_OK); allocs[6]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[5]), ALLOC_OK); allocs[5]=0;
-    assert_int_equal(mem_del_alloc(pool, allocs[8]), ALLOC_OK); allocs[8]=0;
+    assert_non_null(mem_new_alloc(pool, 200));
+    assert_non_null(mem_new_alloc(pool, 300));
+    assert_int_equal(mem_pool_rewind(pool, mark0), ALLOC_OK);
 
-    pool_segment_t exp1[8] =
+    pool_segment_t exp1[2] =
             {
                     {100, 1},
-                    {300, 0},
-                    {100, 1},
-                    {200, 0},
-                    {100, 1},
-                    {100, 0},
-                    {100, 1},
-                    {pool->total_size - 1000, 0},
+                    {pool->total_size - 100, 0}
             };
     check_pool(pool, exp1);
+    check_metadata(pool, ARENA, pool->total_size, 100, 1, 1);
 
 
-    alloc_pt alloc0 = mem_new_alloc(pool, 150);
-    assert_non_null(alloc0);
-    pool_segment_t exp2[9] =
-            {
-                    {100, 1},
-                    {300, 0},
-                    {100, 1},
-                    {150, 1},
-                    {50, 0},
-                    {100, 1},
-                    {100, 0},
-                    {100, 1},
-                    {pool->total_size - 1000, 0},
-            };
-    check_pool(pool, exp2);
-
-
-    // clean up
-    for (i=0; i<NUM_ALLOCS; ++i) {
-        if (allocs[i])
-            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
-    }
-    free(allocs);
-    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
-
-
+    assert_non_null(mem_new_alloc(pool, 50));
+    assert_int_equal(mem_pool_rewind(pool, 0), ALLOC_OK);
     check_pool(pool, exp0);
+    check_metadata(pool, ARENA, pool->total_size, 0, 0, 1);
 }
 
 /*******************************************/
-/***          5. STRESS TEST             ***/
+/***          10. STRESS TEST            ***/
 /***                                     ***/
-/***         [non-functional]            ***/
 /***         [see NOTE below]            ***/
 /*******************************************/
 
@@ -2352,14 +4407,10 @@ void test_pool_stresstest(void **state) {
     alloc_pt allocations[num_pools][num_allocations];
 
     /*
-     * NOTE: This will work iff the address of the allocation
-     * in the pool is returned to the user instead of the
-     * address of the allocation record. Since allocation records
-     * are a part of the nodes, when the node heap is reallocated
-     * the node addresses shift with it, and so do the allocation
-     * record addresses. The allocation addresses on the pool
-     * remain the same, however, so they can be returned to the
-     * user and gotten from the user upon request for deletion.
+     * NOTE: This works because the node heap grows by adding
+     * chunks, so nodes never move. Allocation records are a part
+     * of the nodes, so the record addresses returned to the user
+     * stay valid while the node heap grows under them.
      */
 
     /*
@@ -2422,20 +4473,313 @@ void test_pool_stresstest(void **state) {
     assert_int_equal(mem_free(), ALLOC_OK);
 }
 
+#ifdef MEM_POOL_THREAD_SAFE
+static const unsigned NUM_THREADS = 4;
+static const unsigned NUM_THREAD_ALLOCS = 20000;
+
+static void *stresstest_thread(void *arg) {
+    pool_pt pool = arg;
+    alloc_pt live[16] = {NULL};
+    unsigned long failures = 0;
+
+    // no cmocka asserts off the main thread, count failures instead
+    for (unsigned aix = 0; aix < NUM_THREAD_ALLOCS; ++aix) {
+        unsigned slot = aix % 16;
+        if (live[slot] && mem_del_alloc(pool, live[slot]) != ALLOC_OK)
+            failures++;
+        live[slot] = mem_new_alloc(pool, 16 + (aix * 7) % 200);
+        if (!live[slot])
+            failures++;
+    }
+    for (unsigned slot = 0; slot < 16; ++slot) {
+        if (live[slot] && mem_del_alloc(pool, live[slot]) != ALLOC_OK)
+            failures++;
+    }
+    return (void *) failures;
+}
+
+void test_pool_threads(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Thread-safe builds only:
+     *
+     * 1. 4 threads allocate and deallocate on one pool at once.
+     * 2. Snapshots taken meanwhile are consistent.
+     * 3. The pool ends up a single gap again.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+
+    pthread_t threads[NUM_THREADS];
+    unsigned tix;
+    for (tix = 0; tix < NUM_THREADS; ++tix) {
+        assert_int_equal(pthread_create(&threads[tix], NULL,
+                                        stresstest_thread, pool), 0);
+    }
+
+    pool_t snapshot;
+    for (unsigned six = 0; six < 1000; ++six) {
+        assert_int_equal(mem_pool_snapshot(pool, &snapshot), ALLOC_OK);
+        assert_true(snapshot.alloc_size <= snapshot.total_size);
+        assert_true(snapshot.num_gaps <= snapshot.num_allocs + 1);
+    }
+
+    for (tix = 0; tix < NUM_THREADS; ++tix) {
+        void *failures;
+        assert_int_equal(pthread_join(threads[tix], &failures), 0);
+        assert_null(failures);
+    }
+
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+void test_pool_thread_caches(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Thread-safe builds only:
+     *
+     * 1. BUDDY pools can't have thread caches.
+     * 2. A freed block stays in the thread's cache (still an allocation
+     *    to the pool) and the next allocation of its size gets it back.
+     * 3. At 16 cached blocks of one size class the older 8 go back.
+     * 4. mem_thread_cache_flush() returns the rest.
+     * 5. 4 threads on a cached pool return everything when they exit.
+     * 6. In a 1000-byte pool whose free space is all in the thread's
+     *    cache, an allocation that no gap fits flushes it and succeeds.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt buddy = mem_pool_open(1 << 16, BUDDY);
+    assert_non_null(buddy);
+    assert_int_equal(mem_pool_set_thread_cache(buddy, 1), ALLOC_FAIL);
+    assert_int_equal(mem_pool_close(buddy), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_set_thread_cache(pool, 1), ALLOC_OK);
+
+    alloc_pt alloc = mem_new_alloc(pool, 100);
+    assert_non_null(alloc);
+    assert_int_equal(mem_del_alloc(pool, alloc), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 100, 1, 1);
+    assert_ptr_equal(mem_new_alloc(pool, 100), alloc);
+    assert_int_equal(mem_del_alloc(pool, alloc), ALLOC_OK);
+
+    alloc_pt allocs[20];
+    unsigned aix;
+    for (aix = 0; aix < 20; ++aix) {
+        allocs[aix] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[aix]);
+    }
+    for (aix = 0; aix < 20; ++aix)
+        assert_int_equal(mem_del_alloc(pool, allocs[aix]), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 1200, 12, 2);
+
+    assert_int_equal(mem_thread_cache_flush(pool), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+
+    pthread_t threads[NUM_THREADS];
+    unsigned tix;
+    for (tix = 0; tix < NUM_THREADS; ++tix) {
+        assert_int_equal(pthread_create(&threads[tix], NULL,
+                                        stresstest_thread, pool), 0);
+    }
+    for (tix = 0; tix < NUM_THREADS; ++tix) {
+        void *failures;
+        assert_int_equal(pthread_join(threads[tix], &failures), 0);
+        assert_null(failures);
+    }
+
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    const size_t SMALL_POOL_SIZE = 1000;
+    pool = mem_pool_open(SMALL_POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_set_thread_cache(pool, 1), ALLOC_OK);
+    for (aix = 0; aix < 10; ++aix) {
+        allocs[aix] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[aix]);
+    }
+    for (aix = 0; aix < 10; ++aix)
+        assert_int_equal(mem_del_alloc(pool, allocs[aix]), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, SMALL_POOL_SIZE, 1000, 10, 0);
+
+    alloc = mem_new_alloc(pool, 500);
+    assert_non_null(alloc);
+    check_metadata(pool, FIRST_FIT, SMALL_POOL_SIZE, 500, 1, 1);
+    assert_int_equal(mem_del_alloc(pool, alloc), ALLOC_OK);
+    assert_int_equal(mem_thread_cache_flush(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+void test_pool_sharded_threads(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Thread-safe builds only:
+     *
+     * 1. 4 threads allocate and deallocate on a pool in 4 shards.
+     * 2. The pool ends up a gap per shard again.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open_sharded(POOL_SIZE, BEST_FIT, 4);
+    assert_non_null(pool);
+
+    pthread_t threads[NUM_THREADS];
+    unsigned tix;
+    for (tix = 0; tix < NUM_THREADS; ++tix) {
+        assert_int_equal(pthread_create(&threads[tix], NULL,
+                                        stresstest_thread, pool), 0);
+    }
+    for (tix = 0; tix < NUM_THREADS; ++tix) {
+        void *failures;
+        assert_int_equal(pthread_join(threads[tix], &failures), 0);
+        assert_null(failures);
+    }
+
+    check_metadata(pool, BEST_FIT, POOL_SIZE, 0, 0, 4);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+void test_pool_sharded_thread_caches(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Thread-safe builds only:
+     *
+     * 1. A pool in 4 shards with thread caches on. A freed 32-byte
+     *    block stays in the thread's cache.
+     * 2. Resetting fails while the caches are on, so the cached block
+     *    is not retired and handed out twice.
+     * 3. Compacting fails too, all at once or in steps, so the cached
+     *    block is not moved.
+     * 4. With the cache flushed and turned off, the reset goes through.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open_sharded(POOL_SIZE, FIRST_FIT, 4);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_set_thread_cache(pool, 1), ALLOC_OK);
+
+    alloc_pt alloc = mem_new_alloc(pool, 32);
+    assert_non_null(alloc);
+    assert_int_equal(mem_del_alloc(pool, alloc), ALLOC_OK);
+
+    assert_int_equal(mem_pool_reset(pool), ALLOC_FAIL);
+    alloc_pt alloc0 = mem_new_alloc(pool, 32);
+    alloc_pt alloc1 = mem_new_alloc(pool, 32);
+    assert_ptr_equal(alloc0, alloc);
+    assert_non_null(alloc1);
+    assert_ptr_not_equal(alloc1, alloc0);
+    assert_ptr_not_equal(alloc1->mem, alloc0->mem);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+
+    char *mem0 = alloc0->mem;
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_pool_compact(pool, NULL), ALLOC_FAIL);
+    assert_int_equal(mem_pool_compact_step(pool, 0, 0, NULL), ALLOC_FAIL);
+    assert_ptr_equal(alloc0->mem, mem0);
+
+
+    assert_int_equal(mem_thread_cache_flush(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_set_thread_cache(pool, 0), ALLOC_OK);
+    assert_int_equal(mem_pool_reset(pool), ALLOC_OK);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 4);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static pool_pt remote_pool;
+static alloc_pt remote_allocs[100];
+
+static void *remote_free_thread(void *arg) {
+    unsigned long failures = 0;
+
+    for (unsigned aix = 0; aix < 100; ++aix) {
+        if (mem_del_alloc(remote_pool, remote_allocs[aix]) != ALLOC_OK)
+            failures++;
+    }
+    return (void *) failures;
+}
+
+void test_pool_remote_free(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Thread-safe builds only:
+     *
+     * 1. The main thread owns the pool and allocates 100 blocks.
+     * 2. Another thread frees them; they are only queued.
+     * 3. The owner's next allocation frees the whole queue.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    remote_pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(remote_pool);
+    assert_int_equal(mem_pool_set_remote_free(remote_pool, 1), ALLOC_OK);
+
+    unsigned aix;
+    for (aix = 0; aix < 100; ++aix) {
+        remote_allocs[aix] = mem_new_alloc(remote_pool, 100);
+        assert_non_null(remote_allocs[aix]);
+    }
+
+    pthread_t thread;
+    void *failures;
+    assert_int_equal(pthread_create(&thread, NULL,
+                                    remote_free_thread, NULL), 0);
+    assert_int_equal(pthread_join(thread, &failures), 0);
+    assert_null(failures);
+    check_metadata(remote_pool, FIRST_FIT, POOL_SIZE, 10000, 100, 1);
+
+    alloc_pt alloc = mem_new_alloc(remote_pool, 100);
+    assert_ptr_equal(alloc, remote_allocs[0]);
+    check_metadata(remote_pool, FIRST_FIT, POOL_SIZE, 100, 1, 1);
+
+    pool_stats_t stats;
+    assert_int_equal(mem_pool_stats(remote_pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.remote_frees, 100);
+
+    assert_int_equal(mem_del_alloc(remote_pool, alloc), ALLOC_OK);
+    check_metadata(remote_pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+    assert_int_equal(mem_pool_close(remote_pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+#endif
+
 
 /*******************************************/
-/***         6. DRIVER ROUTINE           ***/
+/***        11. DRIVER ROUTINE           ***/
 /*******************************************/
 
 int run_test_suite() {
     const struct CMUnitTest tests[] = {
             cmocka_unit_test(test_pool_store_smoketest),
+            cmocka_unit_test(test_pool_store_churn),
+            cmocka_unit_test(test_pool_ctx_smoketest),
             cmocka_unit_test(test_pool_smoketest),
 
             cmocka_unit_test(test_pool_nonempty),
 
             cmocka_unit_test_setup_teardown(test_pool_ff_metadata, pool_ff_setup, pool_ff_teardown),
             cmocka_unit_test_setup_teardown(test_pool_bf_metadata, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_node_stats, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_handles, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_quick_lists, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test(test_pool_sharded),
 
             cmocka_unit_test_setup_teardown(test_pool_scenario00, pool_ff_setup, pool_ff_teardown),
             cmocka_unit_test_setup_teardown(test_pool_scenario01, pool_ff_setup, pool_ff_teardown),
@@ -2448,6 +4792,14 @@ int run_test_suite() {
             cmocka_unit_test_setup_teardown(test_pool_scenario08, pool_ff_setup, pool_ff_teardown),
             cmocka_unit_test_setup_teardown(test_pool_scenario09, pool_ff_setup, pool_ff_teardown),
             cmocka_unit_test_setup_teardown(test_pool_scenario10, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario21, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario30, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario31, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario33, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario35, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario36, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario39, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test(test_pool_scenario37),
 
             cmocka_unit_test_setup_teardown(test_pool_scenario11, pool_bf_setup, pool_bf_teardown),
             cmocka_unit_test_setup_teardown(test_pool_scenario12, pool_bf_setup, pool_bf_teardown),
@@ -2458,15 +4810,39 @@ int run_test_suite() {
             cmocka_unit_test_setup_teardown(test_pool_scenario17, pool_bf_setup, pool_bf_teardown),
             cmocka_unit_test_setup_teardown(test_pool_scenario18, pool_bf_setup, pool_bf_teardown),
             cmocka_unit_test_setup_teardown(test_pool_scenario19, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario20, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario28, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario38, pool_bf_setup, pool_bf_teardown),
+
+            cmocka_unit_test_setup_teardown(test_pool_scenario22, pool_tlsf_setup, pool_tlsf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario23, pool_tlsf_setup, pool_tlsf_teardown),
+
+            cmocka_unit_test_setup_teardown(test_pool_scenario24, pool_buddy_setup, pool_buddy_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario25, pool_buddy_setup, pool_buddy_teardown),
 
-            // do not uncomment until the project is changed to return the allocation address
-//            cmocka_unit_test(test_pool_stresstest),
+            cmocka_unit_test_setup_teardown(test_pool_scenario26, pool_fixed_setup, pool_fixed_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario27, pool_fixed_setup, pool_fixed_teardown),
+
+            cmocka_unit_test_setup_teardown(test_pool_scenario29, pool_nf_setup, pool_nf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario40, pool_nf_setup, pool_nf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario41, pool_nf_setup, pool_nf_teardown),
+
+            cmocka_unit_test_setup_teardown(test_pool_scenario32, pool_arena_setup, pool_arena_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scenario34, pool_arena_setup, pool_arena_teardown),
+
+            cmocka_unit_test(test_pool_stresstest),
+#ifdef MEM_POOL_THREAD_SAFE
+            cmocka_unit_test(test_pool_threads),
+            cmocka_unit_test(test_pool_thread_caches),
+            cmocka_unit_test(test_pool_remote_free),
+            cmocka_unit_test(test_pool_sharded_threads),
+            cmocka_unit_test(test_pool_sharded_thread_caches),
+#endif
     };
 
     return cmocka_run_group_tests_name("pool_test_suite", tests, NULL, NULL);
 }
 
 /* future editions */
-// TODO stress test: many pools, many allocations, many gaps (requires project refactoring, see NOTE in test body)
 // TODO test memory leaks: any way to do it w/o having to rewrite the source file?
 // TODO fix the final PASSED line of std::cerr output to the end of the file (?)